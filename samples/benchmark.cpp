@@ -0,0 +1,154 @@
+// benchmark.cpp: measures how entity creation and destruction scale with the number of threads.
+//
+
+#include "myecs.h"
+#include <utils/ChunkedStructureOfArrays.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace myecs;
+
+namespace {
+
+    // Each thread repeatedly spawns a wave of entities one at a time, then destroys them, like
+    // gameplay code spawning projectiles would.
+    double createDestroy(size_t threadCount, size_t rounds, size_t wave) {
+        Database db;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threadCount; t++) {
+            threads.emplace_back([&db, rounds, wave]() {
+                std::vector<Entity> entities(wave);
+                for (size_t r = 0; r < rounds; r++) {
+                    for (auto& e : entities) {
+                        e = db.create();
+                    }
+                    for (auto e : entities) {
+                        db.destroy(e);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+        return double(threadCount * rounds * wave * 2) / elapsed.count();
+    }
+
+    // Validates an array of stored references, a third of which are stale, one handle at a time
+    // and then with the batched isAlive().
+    void validateReferences(size_t count, size_t rounds) {
+        Database db;
+        std::vector<Entity> entities(count);
+        db.create(count, entities.data());
+        std::vector<Entity> references(entities);
+        for (size_t i = 0; i < count; i += 3) {
+            db.destroy(entities[i]);
+        }
+        // scatter the references like target lists would
+        for (size_t i = 0; i < count; i++) {
+            std::swap(references[i], references[(i * 7919) % count]);
+        }
+
+        size_t alive = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (auto e : references) {
+                alive += db.isAlive(e);
+            }
+        }
+        std::chrono::duration<double> const single = std::chrono::steady_clock::now() - start;
+
+        std::vector<uint64_t> aliveMask((count + 63) / 64);
+        start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            db.isAlive(count, references.data(), aliveMask.data());
+            alive += aliveMask[r % aliveMask.size()] & 1u;
+        }
+        std::chrono::duration<double> const batched = std::chrono::steady_clock::now() - start;
+
+        std::printf("isAlive() of %zu references: %.2f ns/entity, batched %.2f ns/entity (%zu)\n", count,
+            single.count() * 1e9 / double(count * rounds), batched.count() * 1e9 / double(count * rounds), alive);
+    }
+
+    struct SparseTraits : ComponentTraits<> {
+        using Index = SparseIndex<Entity>;
+    };
+
+    // Looks up the component of scattered entities, most of which have one.
+    template<typename Manager>
+    double lookup(size_t count, size_t rounds) {
+        Database db;
+        Manager manager;
+        std::vector<Entity> entities(count);
+        db.create(count, entities.data());
+        for (size_t i = 0; i < count; i++) {
+            if (i % 8) {
+                manager.addComponent(entities[i]);
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            std::swap(entities[i], entities[(i * 7919) % count]);
+        }
+
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (auto e : entities) {
+                found += manager.getInstance(e) != 0;
+            }
+        }
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+        return found ? elapsed.count() * 1e9 / double(count * rounds) : 0.0;
+    }
+
+    // Appends rows one at a time, and returns the longest push_back(), in milliseconds: the one
+    // that grows the storage.
+    template<typename SoA>
+    double worstPushBack(size_t count) {
+        SoA soa;
+        double worst = 0;
+        for (size_t i = 0; i < count; i++) {
+            auto start = std::chrono::steady_clock::now();
+            soa.push_back(float(i), float(i), uint32_t(i));
+            std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start;
+            worst = std::max(worst, elapsed.count());
+        }
+        return worst;
+    }
+}
+
+int main()
+{
+    size_t const rounds = 2000;
+    size_t const wave = 256;
+
+    std::printf("create()/destroy() of %zu entities, %zu rounds per thread\n", wave, rounds);
+    std::printf("%8s %16s %12s\n", "threads", "Mops/s", "speed-up");
+    double baseline = 0;
+    for (size_t threadCount : { 1, 2, 4, 8, 16 }) {
+        double const opsPerSecond = createDestroy(threadCount, rounds, wave);
+        if (threadCount == 1) {
+            baseline = opsPerSecond;
+        }
+        std::printf("%8zu %16.2f %11.2fx\n", threadCount, opsPerSecond * 1e-6, opsPerSecond / baseline);
+    }
+
+    validateReferences(1000000, 20);
+
+    std::printf("getInstance() of 1000000 entities: HashIndex %.2f ns/entity, SparseIndex %.2f ns/entity\n",
+        lookup<TComponentManager<float>>(1000000, 10),
+        lookup<TBasicComponentManager<SparseTraits, float>>(1000000, 10));
+
+    std::printf("worst push_back() growing to 10000000 rows: StructureOfArrays %.2f ms, "
+        "with MappedAllocator %.2f ms, ChunkedStructureOfArrays %.2f ms\n",
+        worstPushBack<utils::StructureOfArrays<float, float, uint32_t>>(10000000),
+        worstPushBack<utils::StructureOfArraysBase<utils::MappedAllocator, float, float, uint32_t>>(10000000),
+        worstPushBack<utils::ChunkedStructureOfArrays<16384, float, float, uint32_t>>(10000000));
+    return 0;
+}
@@ -18,13 +18,26 @@ struct Vec2 {
 class MoveObject : public TComponentManager<Vec2, Vec2> {
 };
 
+class Health : public TComponentManager<float> {
+};
+
+struct SparseTraits : ComponentTraits<> {
+    using Index = SparseIndex<Entity>;
+};
+
+class Position : public TBasicComponentManager<SparseTraits, Vec2> {
+};
+
 int main()
 {
     auto& moveManager = *db.getPtr<MoveObject>();
 
+    std::vector<Entity> entities(100000);
+    std::vector<MoveObject::Instance> instances(entities.size());
+    db.create(entities.size(), entities.data());
+    moveManager.addComponents(entities.size(), entities.data(), instances.data());
     for (int i = 0; i < 100000; i++) {
-        auto e = db.create();
-        auto inst = moveManager.addComponent(e);
+        auto inst = instances[i];
         moveManager.elementAt<0>(inst) = { (float)i, (float)i };
         moveManager.elementAt<1>(inst) = { 2.0f, 2.0f };
     }
@@ -36,5 +49,45 @@ int main()
         p.y += v.y;
         //std::cout << "x:" << p.x << ", y:" << p.y << std::endl;
     }
+
+    // only some of the moving objects can be hurt
+    auto& healthManager = *db.getPtr<Health>();
+    for (size_t i = 0; i < entities.size(); i += 10) {
+        healthManager.elementAt<0>(healthManager.addComponent(entities[i])) = 100.0f;
+    }
+
+    View<Columns<const MoveObject, 0>, Health> view(moveManager, healthManager);
+    view.forEach([](Entity, Vec2 const& p, float& health) {
+        if (p.x < 0.0f || p.y < 0.0f) {
+            health = 0.0f;
+        }
+    });
+
+    // An entity destroyed without removing its components leaves them behind. Once its index
+    // is recycled, adding a component to the new entity replaces the stale one.
+    Database recycler(0);
+    Position positions;
+    Entity e;
+    recycler.create(1, &e);
+    positions.addComponent(e);
+    Entity stale = e;
+    recycler.destroy(1, &stale);
+    Entity fresh[1];
+    recycler.create(1, fresh);
+    Position::Instance instance;
+    positions.addComponents(1, fresh, &instance);
+    if (fresh[0].getId() != e.getId() || positions.getComponentCount() != 1 ||
+            positions.hasComponent(e) || positions.getInstance(fresh[0]) != instance) {
+        std::cerr << "the stale component wasn't replaced" << std::endl;
+        return 1;
+    }
+    stale = fresh[0];
+    recycler.destroy(1, &stale);
+    recycler.create(1, &e);
+    positions.addComponent(e);
+    if (positions.getComponentCount() != 1 || positions.hasComponent(fresh[0])) {
+        std::cerr << "the stale component wasn't replaced" << std::endl;
+        return 1;
+    }
     return 0;
 }
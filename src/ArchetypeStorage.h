@@ -0,0 +1,466 @@
+#pragma once
+#include "ComponentIndex.h"
+#include "Entity.h"
+
+#pragma warning(push)
+#pragma warning(disable:4819)
+#include "robin_hood.h"
+#pragma warning(pop)
+
+#include <utils/compiler.h>
+#include <utils/StructureOfArrays.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace myecs {
+
+	namespace details {
+
+		// How an archetype handles a component type it only knows at runtime
+		struct ArchetypeComponentType {
+			uint32_t id;
+			uint32_t size;
+			uint32_t alignment;
+			// move-constructs into dst and destroys src
+			void (*relocate)(void* dst, void* src) noexcept;
+			// nullptr when trivially destructible
+			void (*destroy)(void* p) noexcept;
+		};
+
+		// component types are numbered the first time they're used, with any storage
+		inline constexpr size_t MAX_ARCHETYPE_COMPONENT_TYPES = 64;
+
+		inline std::atomic<ArchetypeComponentType const*>* archetypeComponentTypes() noexcept {
+			static std::atomic<ArchetypeComponentType const*> types[MAX_ARCHETYPE_COMPONENT_TYPES];
+			return types;
+		}
+
+		inline uint32_t nextArchetypeComponentId() {
+			static std::atomic<uint32_t> next{ 0 };
+			uint32_t const id = next.fetch_add(1, std::memory_order_relaxed);
+			if (UTILS_UNLIKELY(id >= MAX_ARCHETYPE_COMPONENT_TYPES)) {
+				// signatures are 64-bits masks
+				throw std::length_error("too many archetype component types");
+			}
+			return id;
+		}
+
+		template<typename T>
+		ArchetypeComponentType const& archetypeComponentType() {
+			static ArchetypeComponentType const type = []() {
+				ArchetypeComponentType t{
+					nextArchetypeComponentId(), uint32_t(sizeof(T)), uint32_t(alignof(T)),
+					[](void* dst, void* src) noexcept {
+						new(dst) T(std::move(*static_cast<T*>(src)));
+						static_cast<T*>(src)->~T();
+					},
+					std::is_trivially_destructible_v<T> ? nullptr : +[](void* p) noexcept {
+						static_cast<T*>(p)->~T();
+					}
+				};
+				return t;
+			}();
+			// published for the archetypes created from a signature
+			static bool const registered = [] {
+				archetypeComponentTypes()[type.id].store(&type, std::memory_order_release);
+				return true;
+			}();
+			(void)registered;
+			return type;
+		}
+	}
+
+	// Stores the components of entities grouped by archetype: all the entities with the same set
+	// of component types (their signature) live together, in chunks of CHUNK_SIZE bytes. Each
+	// chunk is laid out as a structure of arrays, with a column per component type and one for
+	// the entities, so a query walks a few plain arrays per chunk without any lookup.
+	//
+	// Adding or removing a component moves the entity to another archetype; the archetypes keep
+	// the result of each move so that it's a single lookup the next time. Within an archetype,
+	// rows are packed: removing one moves the last row into the hole.
+	//
+	// Component types are numbered process-wide the first time any storage uses them, and up to
+	// 64 of them can be used in total, by all the storages together; using another one throws
+	// std::length_error. So does adding a component whose archetype's rows wouldn't fit in a
+	// chunk. Not thread safe, and pointers to components are invalidated by any structural change.
+	template<typename EntityType = Entity>
+	class TArchetypeStorage {
+	public:
+		using Entity = EntityType;
+		using Signature = uint64_t;
+
+		static constexpr size_t CHUNK_SIZE = 16384;
+		static constexpr size_t CHUNK_ALIGNMENT = 64;
+
+		template<typename ... Ts>
+		static Signature signature() {
+			return ((Signature(1) << details::archetypeComponentType<Ts>().id) | ... | 0);
+		}
+
+		TArchetypeStorage() = default;
+
+		~TArchetypeStorage() noexcept {
+			for (Archetype& a : mArchetypes) {
+				for (size_t c = 0; c < a.types.size(); c++) {
+					if (a.types[c]->destroy) {
+						for (uint32_t row = 0; row < a.size; row++) {
+							a.types[c]->destroy(column(a, c, row));
+						}
+					}
+				}
+				for (std::byte* chunk : a.chunks) {
+					utils::aligned_free(chunk);
+				}
+			}
+		}
+
+		// not copyable
+		TArchetypeStorage(TArchetypeStorage const& rhs) = delete;
+		TArchetypeStorage& operator=(TArchetypeStorage const& rhs) = delete;
+
+		// Adds a T to the entity, or assigns it if it has one already, and returns it
+		template<typename T>
+		T& addComponent(Entity e, T value = T{}) {
+			static_assert(alignof(T) <= CHUNK_ALIGNMENT);
+			static_assert(sizeof(Entity) + sizeof(T) + alignof(T) <= CHUNK_SIZE,
+				"a row with this component doesn't fit in a chunk");
+			assert(!e.isNull());
+			auto const& type = details::archetypeComponentType<T>();
+			uint32_t const found = mIndex.find(e);
+			uint32_t const from = found ? mRecords[found - 1].archetype : NONE;
+			if (from != NONE) {
+				Archetype const& a = mArchetypes[from];
+				if (a.signature & (Signature(1) << type.id)) {
+					T& t = *static_cast<T*>(column(a, a.columnOf[type.id], mRecords[found - 1].row));
+					t = std::move(value);
+					return t;
+				}
+			}
+			// this can throw, do it before the entity gets a record
+			uint32_t const to = from == NONE ?
+				getArchetype(Signature(1) << type.id) : getAddEdge(from, type.id);
+			uint32_t const record = found ? found - 1 : createRecord(e);
+			migrate(e, record, to);
+			Archetype const& a = mArchetypes[to];
+			return *new(column(a, a.columnOf[type.id], mRecords[record].row)) T(std::move(value));
+		}
+
+		// Removes the T of the entity, if it has one
+		template<typename T>
+		void removeComponent(Entity e) {
+			auto const& type = details::archetypeComponentType<T>();
+			uint32_t const record = mIndex.find(e);
+			if (!record) {
+				return;
+			}
+			uint32_t const from = mRecords[record - 1].archetype;
+			Archetype& a = mArchetypes[from];
+			Signature const bit = Signature(1) << type.id;
+			if (!(a.signature & bit)) {
+				return;
+			}
+			if (a.signature == bit) {
+				// that was its last component
+				remove(e);
+				return;
+			}
+			if (type.destroy) {
+				type.destroy(column(a, a.columnOf[type.id], mRecords[record - 1].row));
+			}
+			migrate(e, record - 1, getRemoveEdge(from, type.id), type.id);
+		}
+
+		// Removes all the components of the entity
+		void remove(Entity e) noexcept {
+			uint32_t const record = mIndex.erase(e);
+			if (!record) {
+				return;
+			}
+			Record const r = mRecords[record - 1];
+			Archetype& a = mArchetypes[r.archetype];
+			for (size_t c = 0; c < a.types.size(); c++) {
+				if (a.types[c]->destroy) {
+					a.types[c]->destroy(column(a, c, r.row));
+				}
+			}
+			removeRow(a, r.row);
+			mFreeRecords.push_back(record - 1);
+		}
+
+		template<typename T>
+		T* getComponent(Entity e) {
+			auto const& type = details::archetypeComponentType<T>();
+			uint32_t const record = mIndex.find(e);
+			if (!record) {
+				return nullptr;
+			}
+			Archetype const& a = mArchetypes[mRecords[record - 1].archetype];
+			if (!(a.signature & (Signature(1) << type.id))) {
+				return nullptr;
+			}
+			return static_cast<T*>(column(a, a.columnOf[type.id], mRecords[record - 1].row));
+		}
+
+		template<typename T>
+		bool hasComponent(Entity e) const {
+			return (getSignature(e) & signature<T>()) != 0;
+		}
+
+		// the component types of the entity, 0 if it has none
+		Signature getSignature(Entity e) const noexcept {
+			uint32_t const record = mIndex.find(e);
+			return record ? mArchetypes[mRecords[record - 1].archetype].signature : 0;
+		}
+
+		// number of entities with at least a component
+		size_t size() const noexcept {
+			return mRecords.size() - mFreeRecords.size();
+		}
+
+		size_t getArchetypeCount() const noexcept {
+			return mArchetypes.size();
+		}
+
+		// Calls f(size_t n, Entity const* entities, Ts* ...) for each chunk of the archetypes that
+		// have at least the components Ts, each pointer is an array of n elements.
+		template<typename ... Ts, typename F>
+		void forEachChunk(F&& f) {
+			Signature const required = signature<Ts ...>();
+			for (uint32_t i : getMatchingArchetypes(required)) {
+				Archetype const& a = mArchetypes[i];
+				for (size_t k = 0; k < a.chunks.size(); k++) {
+					uint32_t const first = uint32_t(k * a.capacity);
+					if (first >= a.size) {
+						// the spare chunk
+						break;
+					}
+					size_t const n = std::min<size_t>(a.capacity, a.size - first);
+					f(n, static_cast<Entity const*>(entities(a, first)),
+						static_cast<Ts*>(column(a, a.columnOf[details::archetypeComponentType<Ts>().id], first)) ...);
+				}
+			}
+		}
+
+		// Calls f(Entity, Ts& ...) for each entity that has at least the components Ts
+		template<typename ... Ts, typename F>
+		void forEach(F&& f) {
+			forEachChunk<Ts ...>([&f](size_t n, Entity const* entities, Ts* ... columns) {
+				for (size_t i = 0; i < n; i++) {
+					f(entities[i], columns[i] ...);
+				}
+			});
+		}
+
+	private:
+		static constexpr uint32_t NONE = UINT32_MAX;
+		static constexpr size_t MAX_TYPES = details::MAX_ARCHETYPE_COMPONENT_TYPES;
+
+		struct Archetype {
+			Signature signature = 0;
+			// the component types, by increasing id
+			std::vector<details::ArchetypeComponentType const*> types;
+			// column of each component type, or -1
+			std::array<int8_t, MAX_TYPES> columnOf;
+			// offset of each column in a chunk, the entities are at offset 0
+			std::vector<uint32_t> offsets;
+			// rows per chunk
+			uint32_t capacity = 0;
+			uint32_t size = 0;
+			std::vector<std::byte*> chunks;
+			// archetype reached by adding or removing a component type, NONE until first used
+			std::array<uint32_t, MAX_TYPES> addEdges;
+			std::array<uint32_t, MAX_TYPES> removeEdges;
+		};
+
+		// where the components of an entity are
+		struct Record {
+			uint32_t archetype;
+			uint32_t row;
+		};
+
+		struct Query {
+			std::vector<uint32_t> archetypes;
+			// number of archetypes already checked
+			size_t checked = 0;
+		};
+
+		static void* column(Archetype const& a, size_t c, uint32_t row) noexcept {
+			std::byte* const chunk = a.chunks[row / a.capacity];
+			return chunk + a.offsets[c] + size_t(row % a.capacity) * a.types[c]->size;
+		}
+
+		static void* entities(Archetype const& a, uint32_t row) noexcept {
+			std::byte* const chunk = a.chunks[row / a.capacity];
+			return chunk + size_t(row % a.capacity) * sizeof(Entity);
+		}
+
+		// e must not have a record yet
+		uint32_t createRecord(Entity e) {
+			assert(!mIndex.find(e));
+			// the previous entity with this index was destroyed without remove(), its row would
+			// be orphaned once its slot is overwritten
+			Entity const stale = mIndex.findStale(e);
+			if (UTILS_UNLIKELY(!stale.isNull())) {
+				remove(stale);
+			}
+			uint32_t record;
+			if (!mFreeRecords.empty()) {
+				record = mFreeRecords.back();
+				mFreeRecords.pop_back();
+			} else {
+				record = uint32_t(mRecords.size());
+				mRecords.push_back({});
+			}
+			mRecords[record] = { NONE, 0 };
+			mIndex.insert(e, record + 1);
+			return record;
+		}
+
+		uint32_t getArchetype(Signature signature) {
+			auto pos = mArchetypeMap.find(signature);
+			if (pos != mArchetypeMap.end()) {
+				return pos->second;
+			}
+
+			Archetype a;
+			a.signature = signature;
+			a.columnOf.fill(-1);
+			a.addEdges.fill(NONE);
+			a.removeEdges.fill(NONE);
+			for (Signature bits = signature; bits; bits &= bits - 1) {
+				int const id = std::countr_zero(bits);
+				a.columnOf[id] = int8_t(a.types.size());
+				a.types.push_back(details::archetypeComponentTypes()[id].load(std::memory_order_acquire));
+			}
+
+			// as many rows as fit in a chunk once each column is aligned
+			size_t rowSize = sizeof(Entity);
+			size_t padding = 0;
+			for (auto const* type : a.types) {
+				rowSize += type->size;
+				padding += type->alignment;
+			}
+			if (UTILS_UNLIKELY(padding + rowSize > CHUNK_SIZE)) {
+				// each component fits on its own, but not this combination of them
+				throw std::length_error("archetype row larger than a chunk");
+			}
+			size_t const capacity = (CHUNK_SIZE - padding) / rowSize;
+			a.capacity = uint32_t(capacity);
+			size_t offset = capacity * sizeof(Entity);
+			for (auto const* type : a.types) {
+				offset = (offset + type->alignment - 1) & ~size_t(type->alignment - 1);
+				a.offsets.push_back(uint32_t(offset));
+				offset += capacity * type->size;
+			}
+			assert(offset <= CHUNK_SIZE);
+
+			uint32_t const index = uint32_t(mArchetypes.size());
+			mArchetypes.push_back(std::move(a));
+			mArchetypeMap[signature] = index;
+			return index;
+		}
+
+		uint32_t getAddEdge(uint32_t from, uint32_t id) {
+			uint32_t to = mArchetypes[from].addEdges[id];
+			if (to == NONE) {
+				to = getArchetype(mArchetypes[from].signature | (Signature(1) << id));
+				mArchetypes[from].addEdges[id] = to;
+				mArchetypes[to].removeEdges[id] = from;
+			}
+			return to;
+		}
+
+		uint32_t getRemoveEdge(uint32_t from, uint32_t id) {
+			uint32_t to = mArchetypes[from].removeEdges[id];
+			if (to == NONE) {
+				to = getArchetype(mArchetypes[from].signature & ~(Signature(1) << id));
+				mArchetypes[from].removeEdges[id] = to;
+				mArchetypes[to].addEdges[id] = from;
+			}
+			return to;
+		}
+
+		// Moves the components of the record's entity to a new row of archetype `to`. The
+		// component of type `dropped` (already destroyed) is left behind, and the components
+		// `to` has but the entity doesn't are left for the caller to construct.
+		void migrate(Entity e, uint32_t record, uint32_t to, uint32_t dropped = NONE) {
+			uint32_t const from = mRecords[record].archetype;
+			Archetype& dst = mArchetypes[to];
+			uint32_t const row = dst.size;
+			if (row == dst.chunks.size() * dst.capacity) {
+				dst.chunks.push_back(static_cast<std::byte*>(utils::aligned_alloc(CHUNK_SIZE, CHUNK_ALIGNMENT)));
+			}
+			dst.size++;
+			*static_cast<Entity*>(entities(dst, row)) = e;
+
+			if (from != NONE) {
+				Archetype& src = mArchetypes[from];
+				uint32_t const srcRow = mRecords[record].row;
+				for (size_t c = 0; c < src.types.size(); c++) {
+					uint32_t const id = src.types[c]->id;
+					if (id != dropped) {
+						src.types[c]->relocate(column(dst, dst.columnOf[id], row), column(src, c, srcRow));
+					}
+				}
+				removeRow(src, srcRow);
+			}
+			mRecords[record] = { to, row };
+		}
+
+		// fills the hole left at row with the last row, the hole's components must be destroyed
+		void removeRow(Archetype& a, uint32_t row) noexcept {
+			uint32_t const last = a.size - 1;
+			if (row != last) {
+				for (size_t c = 0; c < a.types.size(); c++) {
+					a.types[c]->relocate(column(a, c, row), column(a, c, last));
+				}
+				Entity const moved = *static_cast<Entity const*>(entities(a, last));
+				*static_cast<Entity*>(entities(a, row)) = moved;
+				uint32_t const record = mIndex.find(moved);
+				assert(record);
+				if (UTILS_LIKELY(record)) {
+					mRecords[record - 1].row = row;
+				}
+			}
+			a.size--;
+			// keep a spare chunk, so that an entity going back and forth doesn't thrash
+			if (a.chunks.size() > 1 && a.size + 2 * size_t(a.capacity) <= a.chunks.size() * a.capacity) {
+				utils::aligned_free(a.chunks.back());
+				a.chunks.pop_back();
+			}
+		}
+
+		std::vector<uint32_t> const& getMatchingArchetypes(Signature required) {
+			// the matches are cached, and only the archetypes created since are checked again
+			Query& query = mQueries[required];
+			for (; query.checked < mArchetypes.size(); query.checked++) {
+				if ((mArchetypes[query.checked].signature & required) == required) {
+					query.archetypes.push_back(uint32_t(query.checked));
+				}
+			}
+			return query.archetypes;
+		}
+
+		std::vector<Archetype> mArchetypes;
+		robin_hood::unordered_map<Signature, uint32_t> mArchetypeMap;
+		robin_hood::unordered_node_map<Signature, Query> mQueries;
+
+		// entity -> record + 1
+		SparseIndex<Entity> mIndex;
+		std::vector<Record> mRecords;
+		std::vector<uint32_t> mFreeRecords;
+	};
+
+	using ArchetypeStorage = TArchetypeStorage<>;
+}
@@ -0,0 +1,231 @@
+#pragma once
+#include "Database.h"
+
+#include <utils/compiler.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace myecs {
+
+	// Records structural changes so they can be made while component managers are being
+	// iterated. Each thread fills its own CommandBuffer without any locking, then playback()
+	// applies them from a single thread.
+	//
+	// Entities are created right away, because Database::create() is thread safe; everything else
+	// is deferred until playback().
+	template<typename Policy>
+	class TCommandBuffer {
+	public:
+		using Database = TDatabase<Policy>;
+		using Entity = typename Database::Entity;
+
+		explicit TCommandBuffer(Database& db) noexcept : mDatabase(db) { }
+
+		~TCommandBuffer() noexcept {
+			clear();
+		}
+
+		// not copyable
+		TCommandBuffer(TCommandBuffer const& rhs) = delete;
+		TCommandBuffer& operator=(TCommandBuffer const& rhs) = delete;
+
+		// Creates entities now, see Database::create()
+		void create(size_t n, Entity* entities) {
+			mDatabase.create(n, entities);
+		}
+
+		Entity create() {
+			Entity e;
+			create(1, &e);
+			return e;
+		}
+
+		// Destroys the entities at playback, after all the component commands
+		void destroy(size_t n, Entity const* entities) {
+			mDestroyed.insert(mDestroyed.end(), entities, entities + n);
+		}
+
+		void destroy(Entity e) {
+			destroy(1, &e);
+		}
+
+		// Adds a component of Manager to the entity at playback, unless it was destroyed by then
+		template<typename Manager>
+		void addComponent(Entity e) {
+			record<Manager>(e, &applyAdd<Manager>, nullptr, nullptr);
+		}
+
+		// Removes the component of Manager from the entity at playback
+		template<typename Manager>
+		void removeComponent(Entity e) {
+			record<Manager>(e, &applyRemove<Manager>, nullptr, nullptr);
+		}
+
+		// Sets the ElementIndex'th element of the entity's component at playback
+		template<typename Manager, size_t ElementIndex>
+		void set(Entity e, typename Manager::SoA::template TypeAt<ElementIndex> value) {
+			using T = typename Manager::SoA::template TypeAt<ElementIndex>;
+			static_assert(alignof(T) <= alignof(std::max_align_t));
+			void* const p = new(allocate(sizeof(T), alignof(T))) T(std::move(value));
+			record<Manager>(e, &applySet<Manager, ElementIndex>,
+				std::is_trivially_destructible_v<T> ? nullptr : &discard<T>, p);
+		}
+
+		// Applies all commands and clears the buffer. Must not run concurrently with anything
+		// touching the managers involved.
+		// Commands are sorted by manager, keeping their order within a manager, and consecutive
+		// commands of the same kind are applied in a single batch. Destroys come last.
+		void playback() {
+			std::stable_sort(mCommands.begin(), mCommands.end(),
+				[](Command const& lhs, Command const& rhs) { return lhs.typeId < rhs.typeId; });
+
+			Command const* const commands = mCommands.data();
+			size_t const count = mCommands.size();
+			for (size_t first = 0; first < count;) {
+				size_t last = first + 1;
+				while (last < count && commands[last].apply == commands[first].apply) {
+					last++;
+				}
+				commands[first].apply(mDatabase, commands + first, last - first);
+				first = last;
+			}
+			// the values have been moved out and destroyed
+			mCommands.clear();
+
+			if (!mDestroyed.empty()) {
+				mDatabase.destroy(mDestroyed.size(), mDestroyed.data());
+				mDestroyed.clear();
+			}
+			reset();
+		}
+
+		// Drops all commands without applying them
+		void clear() noexcept {
+			for (Command const& command : mCommands) {
+				if (command.discard) {
+					command.discard(command.value);
+				}
+			}
+			mCommands.clear();
+			mDestroyed.clear();
+			reset();
+		}
+
+		bool empty() const noexcept {
+			return mCommands.empty() && mDestroyed.empty();
+		}
+
+	private:
+		struct Command;
+		using Apply = void(*)(Database& db, Command const* commands, size_t n);
+		using Discard = void(*)(void* value) noexcept;
+
+		struct Command {
+			// applies a run of commands sharing this function
+			Apply apply;
+			// destroys the value of a set() command that is never played back
+			Discard discard;
+			void* value;
+			Entity entity;
+			int typeId;
+		};
+
+		// Values are stored in blocks that never move, so that they don't need to be
+		// trivially relocatable. Blocks are kept for reuse until the buffer is destroyed.
+		struct Block {
+			std::unique_ptr<std::byte[]> data;
+			size_t size;
+		};
+
+		static constexpr size_t BLOCK_SIZE = 16384;
+
+		template<typename Manager>
+		void record(Entity e, Apply apply, Discard discard, void* value) {
+			static_assert(std::is_same_v<typename Manager::Entity, Entity>,
+				"the manager doesn't use this Database's entities");
+			mCommands.push_back({ apply, discard, value, e, Manager::TypeID });
+		}
+
+		void* allocate(size_t size, size_t alignment) {
+			for (;;) {
+				if (mBlock < mBlocks.size()) {
+					Block const& block = mBlocks[mBlock];
+					uintptr_t const base = uintptr_t(block.data.get());
+					uintptr_t const p = (base + mOffset + alignment - 1) & ~uintptr_t(alignment - 1);
+					if (p + size <= base + block.size) {
+						mOffset = size_t(p + size - base);
+						return reinterpret_cast<void*>(p);
+					}
+					mBlock++;
+					mOffset = 0;
+					continue;
+				}
+				size_t const blockSize = std::max(BLOCK_SIZE, size + alignment);
+				mBlocks.push_back({ std::make_unique<std::byte[]>(blockSize), blockSize });
+			}
+		}
+
+		void reset() noexcept {
+			mBlock = 0;
+			mOffset = 0;
+		}
+
+		template<typename Manager>
+		static void applyAdd(Database& db, Command const* commands, size_t n) {
+			Manager& manager = *db.template getPtr<Manager>();
+			std::vector<Entity> entities(n);
+			for (size_t i = 0; i < n; i++) {
+				entities[i] = commands[i].entity;
+			}
+			n = db.filterAlive(n, entities.data(), entities.data());
+			std::vector<typename Manager::Instance> instances(n);
+			manager.addComponents(n, entities.data(), instances.data());
+		}
+
+		template<typename Manager>
+		static void applyRemove(Database& db, Command const* commands, size_t n) {
+			Manager& manager = *db.template getPtr<Manager>();
+			std::vector<Entity> entities(n);
+			for (size_t i = 0; i < n; i++) {
+				entities[i] = commands[i].entity;
+			}
+			manager.removeComponents(n, entities.data());
+		}
+
+		template<typename Manager, size_t ElementIndex>
+		static void applySet(Database& db, Command const* commands, size_t n) {
+			using T = typename Manager::SoA::template TypeAt<ElementIndex>;
+			Manager& manager = *db.template getPtr<Manager>();
+			for (size_t i = 0; i < n; i++) {
+				T* const value = static_cast<T*>(commands[i].value);
+				auto const ci = manager.getInstance(commands[i].entity);
+				if (ci) {
+					manager.template elementAt<ElementIndex>(ci) = std::move(*value);
+				}
+				value->~T();
+			}
+		}
+
+		template<typename T>
+		static void discard(void* value) noexcept {
+			static_cast<T*>(value)->~T();
+		}
+
+		Database& mDatabase;
+		std::vector<Command> mCommands;
+		std::vector<Entity> mDestroyed;
+		std::vector<Block> mBlocks;
+		size_t mBlock = 0;
+		size_t mOffset = 0;
+	};
+
+	using CommandBuffer = TCommandBuffer<EntityPolicy32>;
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include "ComponentSet.h"
+
+#pragma warning(push)
+#pragma warning(disable:4819)
+#include "robin_hood.h"
+#pragma warning(pop)
+
+#include <utils/compiler.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <assert.h>
+#include <stddef.h>
+
+namespace myecs {
+
+	// Maps entities to the instance of their component in a component manager. A backend
+	// provides:
+	//   Instance find(Entity e) const;       // 0 if e has no component
+	//   void insert(Entity e, Instance i);   // adds or replaces the instance of e
+	//   Instance erase(Entity e);            // returns the instance removed, or 0
+	//   Entity findStale(Entity e) const;    // the handle insert(e) would displace, or null
+	//   void reserve(size_t count);          // makes room for count entities in total
+	//   void shrinkToFit();                  // gives back the memory erased entities used
+
+	// Hash map backend, memory use is proportional to the number of components. This suits
+	// managers that only few entities have a component of.
+	template<typename EntityType>
+	class HashIndex {
+	public:
+		using Entity = EntityType;
+		using Instance = ComponentSet::Type;
+
+		Instance find(Entity e) const noexcept {
+			auto const& map = mMap;
+			// find() generates quite a bit of code
+			auto pos = map.find(e);
+			return pos != map.end() ? pos->second : 0;
+		}
+
+		void insert(Entity e, Instance i) {
+			mMap[e] = i;
+		}
+
+		Instance erase(Entity e) noexcept {
+			auto& map = mMap;
+			auto pos = map.find(e);
+			if (UTILS_LIKELY(pos != map.end())) {
+				Instance const i = pos->second;
+				map.erase(pos);
+				return i;
+			}
+			return 0;
+		}
+
+		// every handle is a key of its own, a recycled index never overwrites its previous entity
+		Entity findStale(Entity) const noexcept {
+			return {};
+		}
+
+		void reserve(size_t count) {
+			mMap.reserve(count);
+		}
+
+		void shrinkToFit() {
+			mMap.compact();
+		}
+
+	private:
+		robin_hood::unordered_map<Entity, Instance, typename Entity::Hasher> mMap;
+	};
+
+	// Sparse array backend, indexed by Entity::getId(). Each slot keeps the whole handle, so that
+	// a stale handle to a recycled index doesn't find the component of the new entity.
+	// Pages are allocated the first time an index in them gets a component, and missing pages
+	// point to a shared empty page, so find() is a couple of loads and a compare.
+	// This suits managers that most entities have a component of.
+	template<typename EntityType>
+	class SparseIndex {
+	public:
+		using Entity = EntityType;
+		using Instance = ComponentSet::Type;
+
+		SparseIndex() noexcept = default;
+
+		SparseIndex(SparseIndex&& rhs) noexcept : mPages(std::move(rhs.mPages)) { }
+
+		SparseIndex& operator=(SparseIndex&& rhs) noexcept {
+			std::swap(mPages, rhs.mPages);
+			return *this;
+		}
+
+		~SparseIndex() noexcept {
+			for (Slot const* page : mPages) {
+				if (page != sEmptyPage) {
+					delete[] page;
+				}
+			}
+		}
+
+		// not copyable
+		SparseIndex(SparseIndex const& rhs) = delete;
+		SparseIndex& operator=(SparseIndex const& rhs) = delete;
+
+		Instance find(Entity e) const noexcept {
+			size_t const id = e.getId();
+			if (UTILS_UNLIKELY((id >> PAGE_SHIFT) >= mPages.size())) {
+				return 0;
+			}
+			Slot const& slot = mPages[id >> PAGE_SHIFT][id & PAGE_MASK];
+			// the null Entity matches the empty slots, which hold instance 0
+			return slot.entity == e ? slot.instance : 0;
+		}
+
+		void insert(Entity e, Instance i) {
+			Slot& slot = getSlot(e.getId());
+			// a stale occupant must be removed first, see findStale()
+			assert(slot.instance == 0 || slot.entity == e);
+			slot.entity = e;
+			slot.instance = i;
+		}
+
+		Instance erase(Entity e) noexcept {
+			size_t const id = e.getId();
+			if (UTILS_UNLIKELY((id >> PAGE_SHIFT) >= mPages.size())) {
+				return 0;
+			}
+			Slot const& slot = mPages[id >> PAGE_SHIFT][id & PAGE_MASK];
+			if (slot.entity != e || slot.instance == 0) {
+				return 0;
+			}
+			// the page can't be the empty one since e was found in it
+			Slot& s = const_cast<Slot&>(slot);
+			Instance const i = s.instance;
+			s.entity.clear();
+			s.instance = 0;
+			return i;
+		}
+
+		// An entity destroyed while it had a component still holds its slot when its index is
+		// recycled. The caller must remove that component before inserting the new entity,
+		// which would otherwise orphan it.
+		Entity findStale(Entity e) const noexcept {
+			size_t const id = e.getId();
+			if (UTILS_UNLIKELY((id >> PAGE_SHIFT) >= mPages.size())) {
+				return {};
+			}
+			Slot const& slot = mPages[id >> PAGE_SHIFT][id & PAGE_MASK];
+			return slot.instance && slot.entity != e ? slot.entity : Entity{};
+		}
+
+		// pages are allocated as entities get a component, there is no way to know which ones
+		void reserve(size_t) noexcept {
+		}
+
+		// frees the pages without any component, and the trailing entries of mPages
+		void shrinkToFit() noexcept {
+			for (Slot const*& page : mPages) {
+				if (page != sEmptyPage && std::all_of(page, page + PAGE_SIZE,
+						[](Slot const& slot) { return slot.instance == 0; })) {
+					delete[] page;
+					page = sEmptyPage;
+				}
+			}
+			while (!mPages.empty() && mPages.back() == sEmptyPage) {
+				mPages.pop_back();
+			}
+			mPages.shrink_to_fit();
+		}
+
+	private:
+		struct Slot {
+			Entity entity;
+			Instance instance = 0;
+		};
+
+		static constexpr const int PAGE_SHIFT = 12;
+		static constexpr const size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+		static constexpr const size_t PAGE_MASK = PAGE_SIZE - 1;
+
+		inline static Slot const sEmptyPage[PAGE_SIZE] = {};
+
+		Slot& getSlot(size_t id) {
+			size_t const p = id >> PAGE_SHIFT;
+			if (p >= mPages.size()) {
+				mPages.resize(p + 1, sEmptyPage);
+			}
+			if (mPages[p] == sEmptyPage) {
+				mPages[p] = new Slot[PAGE_SIZE]();
+			}
+			// only the empty page is const
+			return const_cast<Slot&>(mPages[p][id & PAGE_MASK]);
+		}
+
+		std::vector<Slot const*> mPages;
+	};
+}
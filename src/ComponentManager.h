@@ -11,39 +11,129 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "Entity.h"
+#include "ComponentIndex.h"
 #include "ComponentSet.h"
+#include "Database.h"
+
+#include <algorithm>
+#include <bit>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace myecs {
 
-template <typename ... Elements>
-class UTILS_PUBLIC TComponentManager : public ComponentSet {
+// Compile-time configuration of a component manager, derive from it to override some of it.
+template <typename EntityType = Entity>
+struct ComponentTraits {
+    // handle type used to index the components, this selects the Database it works with.
+    using Entity = EntityType;
+
+    // maps entities to instances, use SparseIndex<Entity> when most entities have a component
+    using Index = HashIndex<EntityType>;
+
+    // When true, removeComponent() moves the last component into the hole, so that
+    // [begin(), end()) only ever holds live components. This changes the instance of the moved
+    // component. Otherwise instances are stable and removed rows are reused by addComponent().
+    static constexpr bool PACKED = false;
+
+    // When true, the manager is a Listener of the Database and removes the components of
+    // destroyed entities itself. Database::getPtr() and addComSet() register it, a manager
+    // created otherwise must be registered with Database::registerListener().
+    // The components are removed by the thread calling Database::destroy(), so two threads
+    // destroying entities at once would modify the manager concurrently. When several threads
+    // destroy entities, enable Database::setDeferredDestroyNotifications() and call
+    // flushDestroyed() from a single thread.
+    static constexpr bool REMOVE_ON_DESTROY = false;
+
+    // When true, the manager stamps each instance with the tick of its last change, see
+    // forEachChanged().
+    static constexpr bool TRACK_CHANGES = false;
+
+    // When true, removing components calls trim(), so that the memory of a spike is given
+    // back once less than a quarter of the capacity is used.
+    static constexpr bool SHRINK_ON_REMOVE = false;
+
+    // allocates the columns, e.g. utils::HugePageAllocator for very large managers, or
+    // utils::PoolAllocator, given to the constructor, for fixed-capacity ones
+    using Allocator = utils::HeapAllocator;
+};
+
+namespace details {
+
+template<typename Entity>
+struct DatabaseOf;
+
+template<typename Policy>
+struct DatabaseOf<TEntity<Policy>> {
+    using type = TDatabase<Policy>;
+};
+
+// base of the managers that don't listen to their Database
+struct NoListener {
+};
+
+template<typename Traits>
+using ManagerListener = std::conditional_t<Traits::REMOVE_ON_DESTROY,
+        typename DatabaseOf<typename Traits::Entity>::type::Listener, NoListener>;
+
+} // namespace details
+
+// Notified of the structural changes of a packed manager, see Group.
+template<typename Entity>
+class ManagerObserver {
+public:
+    // called once the component has been added
+    virtual void onComponentAdded(Entity e) noexcept = 0;
+    // called before the component is removed, the entity may not have one
+    virtual void onComponentRemoving(Entity e) noexcept = 0;
+protected:
+    virtual ~ManagerObserver() noexcept = default;
+};
+
+template <typename Traits, typename ... Elements>
+class UTILS_PUBLIC TBasicComponentManager : public ComponentSet, public details::ManagerListener<Traits> {
 protected:
     static constexpr size_t ENTITY_INDEX = sizeof ... (Elements);
 
 public:
-    using SoA = utils::StructureOfArrays<Elements ..., Entity>;
+    using Entity = typename Traits::Entity;
+
+    using SoA = utils::StructureOfArraysBase<typename Traits::Allocator, Elements ..., Entity>;
 
     using Structure = typename SoA::Structure;
 
     using Instance = ComponentSet::Type;
 	inline static int TypeID = getComponentSetType();
 
-    TComponentManager() noexcept {
+    TBasicComponentManager() noexcept {
         // We always start with a dummy entry because index=0 is reserved. The component
         // at index = 0, is guaranteed to be default-initialized.
         // Sub-classes can use this to their advantage.
         mData.push_back(Structure{});
     }
 
-    TComponentManager(TComponentManager&&) noexcept {/* = default */}
-    TComponentManager& operator=(TComponentManager&&) noexcept {/* = default */}
-    ~TComponentManager() noexcept = default;
+    // For allocators that are handles to an arena or a pool. With a capacity, the columns are
+    // allocated once, as SoA::getNeededSize(capacity + 1) bytes, and don't grow unless more
+    // components are added. Growing past a Pool's block size fails with std::bad_alloc, which
+    // terminates the program from the noexcept SoA growth, so size the blocks for the most
+    // components the manager will ever hold.
+    explicit TBasicComponentManager(typename Traits::Allocator const& allocator, size_t capacity = 0)
+            : mData(capacity + 1, allocator) {
+        mData.push_back(Structure{});
+        mIndex.reserve(capacity);
+    }
+
+    TBasicComponentManager(TBasicComponentManager&&) noexcept {/* = default */}
+    TBasicComponentManager& operator=(TBasicComponentManager&&) noexcept {/* = default */}
+    ~TBasicComponentManager() noexcept = default;
 
     // not copyable
-    TComponentManager(TComponentManager const& rhs) = delete;
-    TComponentManager& operator=(TComponentManager const& rhs) = delete;
+    TBasicComponentManager(TBasicComponentManager const& rhs) = delete;
+    TBasicComponentManager& operator=(TBasicComponentManager const& rhs) = delete;
 
 
     // returns true if the given Entity has a component of this Manager
@@ -53,10 +143,7 @@ public:
 
     // Get instance of this Entity to be used to retrieve components
     Instance getInstance(Entity e) const noexcept {
-        auto const& map = mInstanceMap;
-        // find() generates quite a bit of code
-        auto pos = map.find(e);
-        return pos != map.end() ? pos->second : 0;
+        return mIndex.find(e);
     }
 
     // Returns the number of components (i.e. size of each array)
@@ -69,6 +156,11 @@ public:
         return getComponentCount() == 0;
     }
 
+    // number of components the arrays hold without growing
+    size_t getCapacity() const noexcept {
+        return mData.capacity() - 1;
+    }
+
     Entity const* getEntities() const noexcept {
         return data<ENTITY_INDEX>() + 1;
     }
@@ -83,9 +175,91 @@ public:
     inline Instance addComponent(Entity e);
 
     // Removes a component from the given entity.
+    // Returns the instance removed, or in packed mode the previous instance of the component
+    // moved into its place. 0 if the entity didn't have a component.
     // This invalidates all pointers components.
     inline Instance removeComponent(Entity e);
 
+    // In packed mode, sets the observer told about every component added or removed. There can
+    // be only one.
+    void setObserver(ManagerObserver<Entity>* observer) noexcept {
+        static_assert(Traits::PACKED, "only packed managers can be observed");
+        assert(!observer || !mObserver);
+        mObserver = observer;
+    }
+
+    // Swaps two components, updating the index.
+    // This invalidates all pointers components.
+    void swapComponents(Instance i, Instance j) noexcept {
+        assert(i);
+        assert(j);
+        if (i != j) {
+            mData.swap(i, j);
+            Entity const ei = data<ENTITY_INDEX>()[i];
+            Entity const ej = data<ENTITY_INDEX>()[j];
+            if (ei) {
+                mIndex.insert(ei, i);
+            }
+            if (ej) {
+                mIndex.insert(ej, j);
+            }
+            if constexpr (!Traits::PACKED) {
+                setLive(i, bool(ei));
+                setLive(j, bool(ej));
+            }
+            markChanged(i);
+            markChanged(j);
+        }
+    }
+
+    // Adds a component to each of the n given entities and writes their instances to out, like
+    // addComponent() would. Capacity is reserved once for all of them.
+    // This invalidates all pointers components.
+    inline void addComponents(size_t n, Entity const* entities, Instance* out);
+
+    // Removes the components of the n given entities, like removeComponent() would. In packed
+    // mode the holes are sorted and filled from the end of the arrays in a single pass.
+    // This invalidates all pointers components.
+    inline void removeComponents(size_t n, Entity const* entities);
+
+    // With REMOVE_ON_DESTROY, removes the components of the destroyed entities in one batch.
+    // The entities are sorted first, so that the index is walked in order, unless they already
+    // are, like the batches of Database::flushDestroyed().
+    void onEntitiesDestroyed(size_t n, Entity const* entities) noexcept {
+        static_assert(Traits::REMOVE_ON_DESTROY);
+        auto const byId = [](Entity lhs, Entity rhs) {
+            return lhs.getId() < rhs.getId();
+        };
+        if (std::is_sorted(entities, entities + n, byId)) {
+            removeComponents(n, entities);
+            return;
+        }
+        std::vector<Entity> sorted(entities, entities + n);
+        std::sort(sorted.begin(), sorted.end(), byId);
+        removeComponents(sorted.size(), sorted.data());
+    }
+
+    // Removes the components of entities destroyed in the Database. Each call checks at most
+    // budget instances, in batches, starting where the previous call stopped, so that the cost
+    // of a call is bounded. Returns the number of components removed.
+    // This invalidates all pointers components.
+    template<typename Database>
+    size_t gc(Database const& db, size_t budget = 1024);
+
+    // Gives back the memory of a spike: once less than 1/SoA::SHRINK_RATIO of the capacity is
+    // used, the arrays are reallocated to fit, along with the index and the bookkeeping. In
+    // stable mode, the removed rows at the end are dropped first. Returns the number of rows
+    // copied, 0 if the capacity was kept.
+    // This only touches this manager, so it can run on a worker thread while nothing else uses
+    // the manager. This invalidates all pointers components.
+    size_t trim() override;
+
+    // Like trim(), regardless of how much of the capacity is used.
+    // This invalidates all pointers components.
+    void shrinkToFit() {
+        shrink(getTrimmedSize(), 0);
+    }
+
     // return the first instance
     Instance begin() const noexcept { return 1u; }
 
@@ -114,6 +288,99 @@ public:
         return begin<ElementIndex>() + getComponentCount();
     }
 
+    // returns true if the instance holds a live component
+    bool isLive(Instance i) const noexcept {
+        if constexpr (Traits::PACKED) {
+            return i >= begin() && i < end();
+        } else {
+            return i / 64 < mOccupancy.size() && (mOccupancy[i / 64] >> (i % 64)) & 1u;
+        }
+    }
+
+    // Calls f(Instance first, Slice<TypeAt<ElementIndex>>...) for each run of consecutive live
+    // components, skipping the removed ones 64 instances at a time. The slices all cover the
+    // instances [first, first + size).
+    template<size_t ... ElementIndex, typename F>
+    void forEachLive(F&& f) {
+        if constexpr (Traits::PACKED) {
+            if (!empty()) {
+                callWithSlices<ElementIndex ...>(f, begin(), end());
+            }
+        } else {
+            Instance runBegin = 0;
+            Instance runEnd = 0;
+            for (size_t w = 0, c = mOccupancy.size(); w < c; w++) {
+                uint64_t bits = mOccupancy[w];
+                while (bits) {
+                    int const first = std::countr_zero(bits);
+                    int const length = std::countr_one(bits >> first);
+                    Instance const i = Instance(w * 64 + first);
+                    if (i != runEnd) {
+                        if (runBegin != runEnd) {
+                            callWithSlices<ElementIndex ...>(f, runBegin, runEnd);
+                        }
+                        runBegin = i;
+                    }
+                    runEnd = Instance(i + length);
+                    // the bits below the run are already clear
+                    bits = first + length < 64 ? bits & (~uint64_t(0) << (first + length)) : 0;
+                }
+            }
+            if (runBegin != runEnd) {
+                callWithSlices<ElementIndex ...>(f, runBegin, runEnd);
+            }
+        }
+    }
+
+    // With TRACK_CHANGES, the writes through the non-const elementAt() and Field, and the
+    // instances added or moved, are stamped with the current tick. Writes through pointers and
+    // slices are not seen, use markChanged() for those.
+    void markChanged(Instance i) noexcept {
+        if constexpr (Traits::TRACK_CHANGES) {
+            if (i >= mVersions.size()) {
+                mVersions.resize(std::max(size_t(i) + 1, mData.size()));
+            }
+            if (mVersions[i] != mTick) {
+                mVersions[i] = mTick;
+                mChanges.push_back({ mTick, i });
+            }
+        }
+    }
+
+    uint32_t getTick() const noexcept {
+        return mTick;
+    }
+
+    // Ends the current tick and returns it, typically once per frame. A system that has seen
+    // the changes up to that tick passes it to forEachChanged() next time.
+    uint32_t advanceTick() noexcept {
+        return mTick++;
+    }
+
+    // Calls f(Instance, TypeAt<ElementIndex> const&...) once for each live instance that changed
+    // after the given tick, in the order of their last change. The cost is proportional to the
+    // number of changes recorded since then, not to the number of components.
+    template<size_t ... ElementIndex, typename F>
+    void forEachChanged(uint32_t since, F&& f) const {
+        static_assert(Traits::TRACK_CHANGES);
+        auto it = std::partition_point(mChanges.begin(), mChanges.end(),
+                [since](Change const& c) { return c.tick <= since; });
+        for (; it != mChanges.end(); ++it) {
+            // skip the instances that changed again later, or were removed
+            Instance const i = it->instance;
+            if (mVersions[i] == it->tick && isLive(i)) {
+                f(i, elementAt<ElementIndex>(i) ...);
+            }
+        }
+    }
+
+    // Forgets the changes made up to the given tick, once every system has seen them.
+    void trimChanges(uint32_t tick) {
+        auto it = std::partition_point(mChanges.begin(), mChanges.end(),
+                [tick](Change const& c) { return c.tick <= tick; });
+        mChanges.erase(mChanges.begin(), it);
+    }
+
     // return a Slice<>
     template<size_t ElementIndex>
     utils::Slice<typename SoA::template TypeAt<ElementIndex>> slice() noexcept {
@@ -129,6 +396,7 @@ public:
     template<size_t ElementIndex>
     typename SoA::template TypeAt<ElementIndex>& elementAt(Instance index) noexcept {
         assert(index);
+        markChanged(index);
         return data<ElementIndex>()[index];
     }
 
@@ -148,8 +416,10 @@ public:
     // We need our own version of Field because mData is private
     template<size_t E>
     struct Field : public SoA::template Field<E> {
-        Field(TComponentManager& soa, ComponentSet::Type i) noexcept
+        // a Field gives write access, so it counts as a change
+        Field(TBasicComponentManager& soa, ComponentSet::Type i) noexcept
                 : SoA::template Field<E>{ soa.mData, i } {
+            soa.markChanged(i);
         }
         using SoA::template Field<E>::operator =;
     };
@@ -170,41 +440,114 @@ protected:
         assert(i);
         assert(j);
         if (i && j) {
-            // update the index map
-            auto& map = mInstanceMap;
+            // update the index
             Entity& ei = elementAt<ENTITY_INDEX>(i);
             Entity& ej = elementAt<ENTITY_INDEX>(j);
             std::swap(ei, ej);
             if (ei) {
-                map[ei] = i;
+                mIndex.insert(ei, i);
             }
             if (ej) {
-                map[ej] = j;
+                mIndex.insert(ej, j);
+            }
+            if constexpr (!Traits::PACKED) {
+                setLive(i, bool(ei));
+                setLive(j, bool(ej));
             }
         }
     }
 
+    void setLive(Instance i, bool live) {
+        if (i / 64 >= mOccupancy.size()) {
+            mOccupancy.resize(i / 64 + 1);
+        }
+        uint64_t const bit = uint64_t(1) << (i % 64);
+        mOccupancy[i / 64] = live ? (mOccupancy[i / 64] | bit) : (mOccupancy[i / 64] & ~bit);
+    }
+
+    template<size_t ... ElementIndex, typename F>
+    void callWithSlices(F& f, Instance first, Instance last) {
+        f(first, utils::Slice<typename SoA::template TypeAt<ElementIndex>>{
+                data<ElementIndex>() + first, data<ElementIndex>() + last } ...);
+    }
+
+    // removeComponent() without SHRINK_ON_REMOVE
+    inline Instance eraseComponent(Entity e);
+
+    // number of rows once the removed ones at the end are dropped
+    size_t getTrimmedSize() const noexcept {
+        if constexpr (Traits::PACKED) {
+            return mData.size();
+        } else {
+            size_t w = std::min(mOccupancy.size(), (mData.size() + 63) / 64);
+            while (w && !mOccupancy[w - 1]) {
+                w--;
+            }
+            // the dummy row 0 always stays
+            return w ? (w - 1) * 64 + 64 - std::countl_zero(mOccupancy[w - 1]) : 1;
+        }
+    }
+
+    inline void shrink(size_t size, size_t capacity);
+
+    // resets the components of a reused instance to their default value
+    void resetComponents(Instance i) {
+        [&]<size_t ... I>(std::index_sequence<I ...>) {
+            ((elementAt<I>(i) = typename SoA::template TypeAt<I>{}), ...);
+        }(std::make_index_sequence<ENTITY_INDEX>{});
+    }
+
 protected:
     SoA mData;
 
 private:
     // maps an entity to an instance index
-	robin_hood::unordered_map<Entity, Instance, Entity::Hasher> mInstanceMap;
-	std::vector<Instance> mFreeList;
+    typename Traits::Index mIndex;
+    std::vector<Instance> mFreeList;
+    // one bit per instance, set when it holds a live component. Unused in packed mode, where
+    // they all do.
+    std::vector<uint64_t> mOccupancy;
+    // where the next gc() starts
+    Instance mGcCursor = 0;
+    // in packed mode, see setObserver()
+    ManagerObserver<Entity>* mObserver = nullptr;
+
+    // With TRACK_CHANGES, the tick of the last change of each instance, and a log of the changes
+    // in tick order. An instance is logged once per tick.
+    struct Change {
+        uint32_t tick;
+        Instance instance;
+    };
+    std::vector<uint32_t> mVersions;
+    std::vector<Change> mChanges;
+    uint32_t mTick = 1;
 };
 
+// Component manager for the default Entity layout
+template <typename ... Elements>
+using TComponentManager = TBasicComponentManager<ComponentTraits<>, Elements ...>;
+
 // Keep these outside of the class because CLion has trouble parsing them
-template<typename ... Elements>
-typename TComponentManager<Elements ...>::Instance
-TComponentManager<Elements ...>::addComponent(Entity e) {
+template<typename Traits, typename ... Elements>
+typename TBasicComponentManager<Traits, Elements ...>::Instance
+TBasicComponentManager<Traits, Elements ...>::addComponent(Entity e) {
     Instance ci = 0;
     if (!e.isNull()) {
-        if (!hasComponent(e)) {
+        // if the entity already has this component, just return its instance
+        ci = getInstance(e);
+        if (!ci) {
+
+            // the previous entity with this index was destroyed without removing its component
+            Entity const stale = mIndex.findStale(e);
+            if (UTILS_UNLIKELY(!stale.isNull())) {
+                removeComponent(stale);
+            }
 
             if (!mFreeList.empty()) {
-                auto ci = mFreeList.back();
+                ci = mFreeList.back();
                 mFreeList.pop_back();
-                mData.emplace(ci, Structure{}).template back<ENTITY_INDEX>() = e;
+                resetComponents(ci);
+                elementAt<ENTITY_INDEX>(ci) = e;
 
             } else {
 
@@ -212,12 +555,17 @@ TComponentManager<Elements ...>::addComponent(Entity e) {
                 mData.push_back(Structure{}).template back<ENTITY_INDEX>() = e;
                 // index 0 is used when the component doesn't exist
                 ci = Instance(mData.size() - 1);
+                markChanged(ci);
             }
 
-            mInstanceMap[e] = ci;
-        } else {
-            // if the entity already has this component, just return its instance
-            ci = mInstanceMap[e];
+            mIndex.insert(e, ci);
+            if constexpr (!Traits::PACKED) {
+                setLive(ci, true);
+            } else if (mObserver) {
+                // the observer may move the new component
+                mObserver->onComponentAdded(e);
+                ci = getInstance(e);
+            }
         }
     }
     assert(ci != 0);
@@ -225,20 +573,233 @@ TComponentManager<Elements ...>::addComponent(Entity e) {
 }
 
 // Keep these outside of the class because CLion has trouble parsing them
-template <typename ... Elements>
-typename TComponentManager<Elements ...>::Instance
-TComponentManager<Elements ... >::removeComponent(Entity e) {
-    auto& map = mInstanceMap;
-    auto pos = map.find(e);
-    if (UTILS_LIKELY(pos != map.end())) {
-        auto index = pos->second;
-        assert(index != 0);
-        mFreeList.push_back(index);
-        map.erase(pos);
-        return index;
-    }
-    return 0;
+template <typename Traits, typename ... Elements>
+typename TBasicComponentManager<Traits, Elements ...>::Instance
+TBasicComponentManager<Traits, Elements ... >::removeComponent(Entity e) {
+    Instance const index = eraseComponent(e);
+    if constexpr (Traits::SHRINK_ON_REMOVE) {
+        trim();
+    }
+    return index;
+}
+
+template <typename Traits, typename ... Elements>
+typename TBasicComponentManager<Traits, Elements ...>::Instance
+TBasicComponentManager<Traits, Elements ... >::eraseComponent(Entity e) {
+    if constexpr (Traits::PACKED) {
+        if (mObserver) {
+            mObserver->onComponentRemoving(e);
+        }
+    }
+    Instance const index = mIndex.erase(e);
+    if (UTILS_LIKELY(index)) {
+        if constexpr (Traits::PACKED) {
+            Instance const last = Instance(mData.size() - 1);
+            if (last != index) {
+                // move the last item to where we removed this component, as to keep
+                // the array tightly packed.
+                mData.forEach([index, last](auto* p) {
+                    p[index] = std::move(p[last]);
+                });
+                mIndex.insert(elementAt<ENTITY_INDEX>(index), index);
+            }
+            mData.pop_back();
+            return last;
+        } else {
+            // the row stays in place, it no longer belongs to any entity
+            elementAt<ENTITY_INDEX>(index) = Entity{};
+            mFreeList.push_back(index);
+            setLive(index, false);
+        }
+    }
+    return index;
 }
 
 
-}
\ No newline at end of file
+template<typename Traits, typename ... Elements>
+void TBasicComponentManager<Traits, Elements ...>::addComponents(size_t n, Entity const* entities, Instance* out) {
+    static_assert(std::is_trivially_copyable_v<Entity>);
+    mIndex.reserve(getComponentCount() + n);
+
+    // components left by destroyed entities whose index was recycled, see addComponent()
+    std::vector<Entity> stale;
+    for (size_t i = 0; i < n; i++) {
+        Entity const e = entities[i];
+        if (!e.isNull() && !getInstance(e)) {
+            Entity const s = mIndex.findStale(e);
+            if (UTILS_UNLIKELY(!s.isNull())) {
+                stale.push_back(s);
+            }
+        }
+    }
+    if (!stale.empty()) {
+        removeComponents(stale.size(), stale.data());
+    }
+
+    // new rows are numbered now, and created all at once below
+    Instance const base = Instance(mData.size());
+    Instance next = base;
+    for (size_t i = 0; i < n; i++) {
+        Entity const e = entities[i];
+        Instance ci = 0;
+        if (!e.isNull()) {
+            ci = getInstance(e);
+            if (!ci) {
+                if (!mFreeList.empty()) {
+                    ci = mFreeList.back();
+                    mFreeList.pop_back();
+                    resetComponents(ci);
+                    elementAt<ENTITY_INDEX>(ci) = e;
+                } else {
+                    ci = next++;
+                }
+                mIndex.insert(e, ci);
+                if constexpr (!Traits::PACKED) {
+                    setLive(ci, true);
+                }
+            }
+        }
+        out[i] = ci;
+    }
+
+    if (next != base) {
+        mData.resizeZeroed(next);
+        for (Instance i = base; i < next; i++) {
+            markChanged(i);
+        }
+        mData.template assignNewRows<ENTITY_INDEX>(base, n, entities, out);
+    }
+
+    if constexpr (Traits::PACKED) {
+        if (mObserver) {
+            // the observer may move the new components
+            for (size_t i = 0; i < n; i++) {
+                if (out[i]) {
+                    mObserver->onComponentAdded(entities[i]);
+                }
+            }
+            for (size_t i = 0; i < n; i++) {
+                out[i] = getInstance(entities[i]);
+            }
+        }
+    }
+}
+
+template<typename Traits, typename ... Elements>
+void TBasicComponentManager<Traits, Elements ...>::removeComponents(size_t n, Entity const* entities) {
+    if constexpr (Traits::PACKED) {
+        if (mObserver) {
+            for (size_t i = 0; i < n; i++) {
+                mObserver->onComponentRemoving(entities[i]);
+            }
+        }
+        std::vector<Instance> holes;
+        holes.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            Instance const ci = mIndex.erase(entities[i]);
+            if (ci) {
+                holes.push_back(ci);
+            }
+        }
+        std::sort(holes.begin(), holes.end());
+        mData.eraseSorted(holes.data(), holes.size(), [this](size_t hole) {
+            mIndex.insert(elementAt<ENTITY_INDEX>(Instance(hole)), Instance(hole));
+        });
+    } else {
+        // the rows stay in place, there is nothing to compact
+        mFreeList.reserve(mFreeList.size() + n);
+        for (size_t i = 0; i < n; i++) {
+            eraseComponent(entities[i]);
+        }
+    }
+    if constexpr (Traits::SHRINK_ON_REMOVE) {
+        trim();
+    }
+}
+
+
+template<typename Traits, typename ... Elements>
+template<typename Database>
+size_t TBasicComponentManager<Traits, Elements ...>::gc(Database const& db, size_t budget) {
+    static_assert(std::is_same_v<typename Database::Entity, Entity>,
+            "the Database doesn't use this manager's entities");
+    constexpr size_t BATCH_SIZE = 256;
+    Entity batch[BATCH_SIZE];
+    Entity dead[BATCH_SIZE];
+    uint64_t aliveMask[BATCH_SIZE / 64];
+
+    size_t removed = 0;
+    size_t remaining = std::min(budget, getComponentCount());
+    while (remaining) {
+        if (mGcCursor < begin() || mGcCursor >= end()) {
+            mGcCursor = begin();
+        }
+        size_t const count = std::min({ BATCH_SIZE, remaining, size_t(end() - mGcCursor) });
+        Entity const* const entities = data<ENTITY_INDEX>() + mGcCursor;
+        std::copy(entities, entities + count, batch);
+        db.isAlive(count, batch, aliveMask);
+
+        // removed rows hold the null entity
+        size_t deadCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (batch[i] && !((aliveMask[i / 64] >> (i % 64)) & 1u)) {
+                dead[deadCount++] = batch[i];
+            }
+        }
+        if (deadCount) {
+            // count what was actually removed, a dead entity may not have a component anymore
+            size_t const live = getComponentCount() - mFreeList.size();
+            removeComponents(deadCount, dead);
+            removed += live - (getComponentCount() - mFreeList.size());
+        }
+        mGcCursor = Instance(mGcCursor + count);
+        remaining -= count;
+    }
+    return removed;
+}
+
+template<typename Traits, typename ... Elements>
+size_t TBasicComponentManager<Traits, Elements ...>::trim() {
+    if constexpr (!Traits::PACKED) {
+        // the live components are a lower bound of the trimmed size, this rejects most calls
+        if (mData.size() - mFreeList.size() >= mData.capacity() / SoA::SHRINK_RATIO) {
+            return 0;
+        }
+    }
+    size_t const size = getTrimmedSize();
+    size_t const capacity = mData.getTrimmedCapacity(size);
+    if (capacity == mData.capacity()) {
+        return 0;
+    }
+    shrink(size, capacity);
+    return size;
+}
+
+template<typename Traits, typename ... Elements>
+void TBasicComponentManager<Traits, Elements ...>::shrink(size_t size, size_t capacity) {
+    if constexpr (!Traits::PACKED) {
+        if (size < mData.size()) {
+            mData.resize(size);
+            mFreeList.erase(std::remove_if(mFreeList.begin(), mFreeList.end(),
+                    [size](Instance i) { return i >= size; }), mFreeList.end());
+        }
+        size_t const words = (size + 63) / 64;
+        if (mOccupancy.size() > words) {
+            mOccupancy.resize(words);
+        }
+        mOccupancy.shrink_to_fit();
+    }
+    mFreeList.shrink_to_fit();
+    mData.setCapacity(std::max(size, capacity));
+    mIndex.shrinkToFit();
+    if constexpr (Traits::TRACK_CHANGES) {
+        if (mVersions.size() > size) {
+            mVersions.resize(size);
+        }
+        mVersions.shrink_to_fit();
+        mChanges.erase(std::remove_if(mChanges.begin(), mChanges.end(),
+                [size](Change const& change) { return change.instance >= size; }), mChanges.end());
+    }
+}
+
+}
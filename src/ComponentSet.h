@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -8,6 +9,15 @@ namespace myecs {
 	public:
 		using Type = uint32_t;
 
+		// the Database owns its component sets through this base
+		virtual ~ComponentSet() noexcept = default;
+
+		// Gives back the capacity the set no longer needs, see Database::trimComponents().
+		// Returns the number of rows copied to do so, 0 if nothing was done.
+		virtual size_t trim() {
+			return 0;
+		}
+
 		static int getComponentSetType() {
 			static int type = 0;
 			return type++;
@@ -1,67 +1,413 @@
 #include "Database.h"
 
+#include <bit>
+#include <new>
+
+#include <stddef.h>
+
+#if MYECS_HAS_VIRTUAL_MEMORY
+#   include <sys/mman.h>
+#endif
+
+// the paged kernel gathers 64-bits page pointers, so only x86-64 has it
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#   define MYECS_HAS_AVX2_GATHER 1
+#   include <immintrin.h>
+#else
+#   define MYECS_HAS_AVX2_GATHER 0
+#endif
+
 namespace myecs {
 
-	Database::Database() {
-		mGens = new uint8_t * [RAW_INDEX_COUNT / MIN_VER_COUNT];
-		std::fill_n(mGens, RAW_INDEX_COUNT / MIN_VER_COUNT, nullptr);
-		mGens[0] = new uint8_t[MIN_VER_COUNT];
-		std::fill_n(mGens[0], MIN_VER_COUNT, 0);
-	}
+	namespace {
+
+#if MYECS_HAS_VIRTUAL_MEMORY
+		// reserves address space, which gets committed as it is touched
+		void* reserve(size_t size) {
+			void* const p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (p == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+
+		void release(void* p, size_t size) noexcept {
+			::munmap(p, size);
+		}
+
+		// gives the memory back to the OS, it reads as zeroes afterwards
+		void decommit(void* p, size_t size) noexcept {
+#if defined(__linux__)
+			::madvise(p, size, MADV_DONTNEED);
+#else
+			// MADV_DONTNEED doesn't guarantee zeroes elsewhere, map fresh pages over the range
+			::mmap(p, size, PROT_READ | PROT_WRITE,
+				MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#endif
+		}
+#endif
+
+		// a counter with a single writer doesn't need a read-modify-write
+		void addExclusive(std::atomic<size_t>& counter, size_t n) noexcept {
+			counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+#if MYECS_HAS_AVX2_GATHER
+		bool hasAvx2() noexcept {
+			static bool const avx2 = __builtin_cpu_supports("avx2");
+			return avx2;
+		}
+
+		// isAlive() of n (a multiple of 8) 32-bits handles with 8-bits generations, 8 at a time.
+		// Both the page pointers and the generations are gathered, lanes whose page isn't published
+		// are masked out. Generations are read as 32-bits words, which is fine because they're
+		// followed by more data in their page. On x86 these loads have acquire semantics already.
+		__attribute__((target("avx2")))
+		void isAliveAvx2(size_t n, uint32_t const* handles, long long const* pages,
+				int indexBits, int pageShift, uint8_t* aliveMask) noexcept {
+			__m256i const indexMask = _mm256_set1_epi32(int((1u << indexBits) - 1u));
+			__m256i const offsetMask = _mm256_set1_epi32(int((1u << pageShift) - 1u));
+			__m128i const versionShift = _mm_cvtsi32_si128(indexBits);
+			__m128i const pageIndexShift = _mm_cvtsi32_si128(pageShift);
+			__m256i const generationMask = _mm256_set1_epi32(0xff);
+			__m256i const zero = _mm256_setzero_si256();
+			__m256i const ones = _mm256_set1_epi32(-1);
+			// packs the low halves of four 64-bits lanes
+			__m256i const evenLanes = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+			for (size_t i = 0; i < n; i += 8) {
+				__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(handles + i));
+				__m256i const ids = _mm256_and_si256(v, indexMask);
+				__m256i const versions = _mm256_srl_epi32(v, versionShift);
+				__m256i const pageIndices = _mm256_srl_epi32(ids, pageIndexShift);
+				__m256i const offsets = _mm256_and_si256(ids, offsetMask);
+
+				__m256i const pagesLo = _mm256_i32gather_epi64(pages, _mm256_castsi256_si128(pageIndices), 8);
+				__m256i const pagesHi = _mm256_i32gather_epi64(pages, _mm256_extracti128_si256(pageIndices, 1), 8);
+				__m256i const publishedLo = _mm256_xor_si256(_mm256_cmpeq_epi64(pagesLo, zero), ones);
+				__m256i const publishedHi = _mm256_xor_si256(_mm256_cmpeq_epi64(pagesHi, zero), ones);
+				__m128i const maskLo = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(publishedLo, evenLanes));
+				__m128i const maskHi = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(publishedHi, evenLanes));
+
+				__m256i const addressesLo = _mm256_add_epi64(pagesLo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(offsets)));
+				__m256i const addressesHi = _mm256_add_epi64(pagesHi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(offsets, 1)));
+				__m128i const gensLo = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), nullptr, addressesLo, maskLo, 1);
+				__m128i const gensHi = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), nullptr, addressesHi, maskHi, 1);
+				__m256i const gens = _mm256_and_si256(_mm256_set_m128i(gensHi, gensLo), generationMask);
 
-	Database::~Database() {
-		for (int i = 0; i < RAW_INDEX_COUNT / MIN_VER_COUNT; i++) {
-			if (mGens[i]) {
-				delete mGens[i];
+				__m256i alive = _mm256_cmpeq_epi32(gens, versions);
+				alive = _mm256_andnot_si256(_mm256_cmpeq_epi32(ids, zero), alive);
+				alive = _mm256_and_si256(_mm256_set_m128i(maskHi, maskLo), alive);
+				aliveMask[i / 8] = uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(alive)));
 			}
 		}
 
-		delete mGens;
+		// Same as above, for a flat array of generations.
+		__attribute__((target("avx2")))
+		void isAliveFlatAvx2(size_t n, uint32_t const* handles, int const* gens, int indexBits,
+				uint8_t* aliveMask) noexcept {
+			__m256i const indexMask = _mm256_set1_epi32(int((1u << indexBits) - 1u));
+			__m128i const versionShift = _mm_cvtsi32_si128(indexBits);
+			__m256i const generationMask = _mm256_set1_epi32(0xff);
+			__m256i const zero = _mm256_setzero_si256();
+
+			for (size_t i = 0; i < n; i += 8) {
+				__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(handles + i));
+				__m256i const ids = _mm256_and_si256(v, indexMask);
+				__m256i const versions = _mm256_srl_epi32(v, versionShift);
+				__m256i const g = _mm256_and_si256(_mm256_i32gather_epi32(gens, ids, 1), generationMask);
+				__m256i alive = _mm256_cmpeq_epi32(g, versions);
+				alive = _mm256_andnot_si256(_mm256_cmpeq_epi32(ids, zero), alive);
+				aliveMask[i / 8] = uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(alive)));
+			}
+		}
+#endif
+
+		// Hands out small dense ids to threads, so each of them can own one of the
+		// TDatabase::ThreadCache. Ids are recycled when threads exit, a new thread then inherits
+		// whatever indices were left in the cache.
+		class ThreadSlots {
+		public:
+			static uint32_t acquire() noexcept {
+				ThreadSlots& slots = get();
+				std::lock_guard<std::mutex> const lock(slots.mLock);
+				if (!slots.mFree.empty()) {
+					uint32_t const id = slots.mFree.back();
+					slots.mFree.pop_back();
+					return id;
+				}
+				return slots.mNext++;
+			}
+
+			static void release(uint32_t id) noexcept {
+				ThreadSlots& slots = get();
+				std::lock_guard<std::mutex> const lock(slots.mLock);
+				slots.mFree.push_back(id);
+			}
+
+		private:
+			static ThreadSlots& get() noexcept {
+				static ThreadSlots slots;
+				return slots;
+			}
+
+			std::mutex mLock;
+			std::vector<uint32_t> mFree;
+			uint32_t mNext = 0;
+		};
+
+		struct ThreadSlot {
+			uint32_t const id = ThreadSlots::acquire();
+			~ThreadSlot() noexcept { ThreadSlots::release(id); }
+		};
+
+		uint32_t getThreadSlot() noexcept {
+			thread_local ThreadSlot slot;
+			return slot.id;
+		}
+	}
+
+	template<typename Policy>
+	TDatabase<Policy>::Listener::~Listener() noexcept = default;
+
+	// the batched isAlive() reads generations as 32-bits words, so there is some slack at the end
+	template<typename Policy>
+	static constexpr size_t GENS_RESERVED_SIZE =
+		TDatabase<Policy>::RAW_INDEX_COUNT * sizeof(typename Policy::Generation) + 64;
+
+	template<typename Policy>
+	static constexpr size_t NEXT_RESERVED_SIZE =
+		TDatabase<Policy>::RAW_INDEX_COUNT * sizeof(typename Policy::Type);
+
+	template<typename Policy>
+	TDatabase<Policy>::TDatabase(size_t minFreeIndices)
+		: mMinFreeIndices(minFreeIndices), mThreadCaches(new ThreadCache[THREAD_CACHE_COUNT]) {
+#if MYECS_HAS_VIRTUAL_MEMORY
+		if constexpr (VIRTUAL_MEMORY) {
+			mGens = static_cast<Generation*>(reserve(GENS_RESERVED_SIZE<Policy>));
+			mNext = static_cast<Type*>(reserve(NEXT_RESERVED_SIZE<Policy>));
+			return;
+		}
+#endif
+		mPages = new std::atomic<Page*>[RAW_INDEX_COUNT / MIN_VER_COUNT]();
+		ensurePages(0, 1);
+	}
+
+	template<typename Policy>
+	TDatabase<Policy>::~TDatabase() {
+		delete mListeners.load(std::memory_order_relaxed);
+
+#if MYECS_HAS_VIRTUAL_MEMORY
+		if constexpr (VIRTUAL_MEMORY) {
+			release(mGens, GENS_RESERVED_SIZE<Policy>);
+			release(mNext, NEXT_RESERVED_SIZE<Policy>);
+			return;
+		}
+#endif
+		for (size_t i = 0; i < RAW_INDEX_COUNT / MIN_VER_COUNT; i++) {
+			delete mPages[i].load(std::memory_order_relaxed);
+		}
+
+		delete[] mPages;
 	}
 
-	void Database::create(size_t n, Entity* entities) {
-		Entity::Type index{};
+	template<typename Policy>
+	typename TDatabase<Policy>::ThreadCache* TDatabase<Policy>::getThreadCache() const noexcept {
+		uint32_t const slot = getThreadSlot();
+		return slot < THREAD_CACHE_COUNT ? &mThreadCaches[slot] : nullptr;
+	}
+
+	template<typename Policy>
+	bool TDatabase<Policy>::refillThreadCache(ThreadCache& cache) noexcept {
+		assert(cache.recycled.count == 0);
+		bool const exhausted = mCurrentIndex.load(std::memory_order_relaxed) >= RAW_INDEX_COUNT;
+		if (cache.freed.count && (exhausted ||
+				canRecycle(mFreeListSize.load(std::memory_order_relaxed) + cache.freed.count))) {
+			// the indices this thread freed count toward minFreeIndices, don't wait for a full block
+			drainThreadCache(cache);
+		}
+
+		// don't bother with the lock if there is obviously nothing to recycle
+		if (!canRecycle(mFreeListSize.load(std::memory_order_relaxed))) {
+			return false;
+		}
+
+		std::lock_guard<std::mutex> const lock(mFreeListLock);
 		auto& freeList = mFreeList;
+		if (canRecycle(freeList.count)) {
+			size_t const available = exhausted ? freeList.count : freeList.count - mMinFreeIndices;
+			for (size_t count = std::min(available, THREAD_CACHE_BLOCK); count; count--) {
+				pushBack(cache.recycled, popFront(freeList));
+			}
+		}
+		mFreeListSize.store(freeList.count, std::memory_order_relaxed);
+		return cache.recycled.count > 0;
+	}
 
-		// this must be thread-safe, acquire the free-list mutex
+	template<typename Policy>
+	void TDatabase<Policy>::drainThreadCache(ThreadCache& cache) noexcept {
 		std::lock_guard<std::mutex> const lock(mFreeListLock);
-		Entity::Type currentIndex = mCurrentIndex;
-		for (size_t i = 0; i < n; i++) {
-			// If we have more than a certain number of freed indices, get one from the list.
-			// this is a trade-off between how often we recycle indices and how large the free list
-			// can grow.
-			if (freeList.size() > 0) {
-				index = freeList.front();
-				freeList.pop_front();
-			}
-			else {
-				if (currentIndex >= RAW_INDEX_COUNT) {
-					entities[i] = {};
-					continue;
+		auto& freeList = mFreeList;
+		// the indices freed by this thread go to the back of the free-list as a whole, recycling
+		// stays in FIFO order.
+		append(freeList, cache.freed);
+		mFreeListSize.store(freeList.count, std::memory_order_relaxed);
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::ensurePages(Type first, Type last) {
+		if constexpr (VIRTUAL_MEMORY) {
+			// the OS takes care of it
+			return;
+		}
+		for (Type page = first >> MIN_VER_SHIFT; page <= (last - 1) >> MIN_VER_SHIFT; page++) {
+			if (mPages[page].load(std::memory_order_acquire) == nullptr) {
+				// this happens once every MIN_VER_COUNT indices, it's okay to take a lock here
+				std::lock_guard<std::mutex> const lock(mFreeListLock);
+				if (mPages[page].load(std::memory_order_relaxed) == nullptr) {
+					// the generations must be zero before isAlive() can see the page
+					Page* const p = new Page();
+					mPages[page].store(p, std::memory_order_release);
+				}
+			}
+		}
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::isAlive(size_t n, Entity const* entities, uint64_t* aliveMask) const noexcept {
+		std::fill_n(aliveMask, (n + 63) / 64, 0);
+		size_t i = 0;
+#if MYECS_HAS_AVX2_GATHER
+		if constexpr (sizeof(Entity) == sizeof(uint32_t) && sizeof(typename Policy::Generation) == 1 && VIRTUAL_MEMORY) {
+			if (hasAvx2()) {
+				i = n & ~size_t(7);
+				isAliveFlatAvx2(i, reinterpret_cast<uint32_t const*>(entities),
+					reinterpret_cast<int const*>(mGens), GENERATION_SHIFT, reinterpret_cast<uint8_t*>(aliveMask));
+			}
+		}
+		else if constexpr (sizeof(Entity) == sizeof(uint32_t) && sizeof(typename Policy::Generation) == 1) {
+			static_assert(sizeof(std::atomic<Page*>) == sizeof(long long));
+			static_assert(offsetof(Page, gens) == 0 && sizeof(Page) >= sizeof(Page::gens) + 3);
+			if (hasAvx2()) {
+				// the mask is written a byte at a time, which matches the words on little-endian
+				i = n & ~size_t(7);
+				isAliveAvx2(i, reinterpret_cast<uint32_t const*>(entities),
+					reinterpret_cast<long long const*>(mPages), GENERATION_SHIFT, MIN_VER_SHIFT,
+					reinterpret_cast<uint8_t*>(aliveMask));
+			}
+		}
+#endif
+		for (; i < n; i++) {
+			if (isAlive(entities[i])) {
+				aliveMask[i / 64] |= uint64_t(1) << (i % 64);
+			}
+		}
+	}
+
+	template<typename Policy>
+	size_t TDatabase<Policy>::filterAlive(size_t n, Entity const* entities, Entity* out) const noexcept {
+		constexpr size_t BATCH_SIZE = 512;
+		uint64_t aliveMask[BATCH_SIZE / 64];
+		size_t count = 0;
+		for (size_t first = 0; first < n; first += BATCH_SIZE) {
+			size_t const size = std::min(BATCH_SIZE, n - first);
+			isAlive(size, entities + first, aliveMask);
+			// we never write past what we've read, so this works in place
+			for (size_t w = 0; w < (size + 63) / 64; w++) {
+				for (uint64_t bits = aliveMask[w]; bits; bits &= bits - 1) {
+					out[count++] = entities[first + w * 64 + std::countr_zero(bits)];
+				}
+			}
+		}
+		return count;
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::create(size_t n, Entity* entities) {
+		size_t i = 0;
+		size_t recycled = 0;
+		ThreadCache* const cache = getThreadCache();
+		do {
+			// First, recycle indices that got freed, but only if we have more than a certain number of
+			// them. This is a trade-off between how often we recycle indices and how large the free
+			// list can grow.
+			if (cache) {
+				while (i < n && (cache->recycled.count || refillThreadCache(*cache))) {
+					while (i < n && cache->recycled.count) {
+						Type const index = popFront(cache->recycled);
+						entities[i++] = makeEntity(index);
+						recycled++;
+					}
 				}
-				// In the common case, we just grab the next index.
-				// This works only until all indices have been used once, at which point
-				// we're always in the slower case above. The idea is that we have enough indices
-				// that it doesn't happen in practice.
-				index = currentIndex++;
-
-				if (mGens[index >> MIN_VER_SHIFT] == nullptr) {
-					mGens[index >> MIN_VER_SHIFT] = new uint8_t[MIN_VER_COUNT];
-					std::fill_n(mGens[index >> MIN_VER_SHIFT], MIN_VER_COUNT, 0);
+			}
+			else if (canRecycle(mFreeListSize.load(std::memory_order_relaxed))) {
+				// this thread doesn't have a cache, use the shared free-list directly
+				std::lock_guard<std::mutex> const lock(mFreeListLock);
+				auto& freeList = mFreeList;
+				while (i < n && canRecycle(freeList.count)) {
+					Type const index = popFront(freeList);
+					entities[i++] = makeEntity(index);
+					recycled++;
+				}
+				mFreeListSize.store(freeList.count, std::memory_order_relaxed);
+			}
+
+			if (i == n) {
+				break;
+			}
+
+			// In the common case, we just grab the next indices, all at once.
+			// This works only until all indices have been used once, at which point
+			// we're always in the slower case above. The idea is that we have enough indices
+			// that it doesn't happen in practice.
+			Type first = RAW_INDEX_COUNT;
+			if (mCurrentIndex.load(std::memory_order_relaxed) < RAW_INDEX_COUNT) {
+				// checked first so that mCurrentIndex can't wrap around
+				first = mCurrentIndex.fetch_add(Type(n - i), std::memory_order_relaxed);
+			}
+			Type const last = Type(std::min<size_t>(first + (n - i), RAW_INDEX_COUNT));
+			if (first < last) {
+				ensurePages(first, last);
+				for (Type index = first; index < last; index++) {
+					entities[i++] = makeEntity(index);
 				}
+			}
 
+			if (i == n) {
+				break;
 			}
 
-			entities[i] = Entity{ index, getGen(index) };
-#
+			// all indices are in use, see if trim() set some aside
+		} while (reviveRange());
+
+		if (cache) {
+			addExclusive(cache->counters.created, i);
+			addExclusive(cache->counters.recycled, recycled);
+		}
+		else {
+			mCounters.created.fetch_add(i, std::memory_order_relaxed);
+			mCounters.recycled.fetch_add(recycled, std::memory_order_relaxed);
+		}
+
+		// we ran out of indices
+		for (; i < n; i++) {
+			entities[i] = {};
 		}
-		mCurrentIndex = currentIndex;
 	}
-	
-	void Database::destroy(size_t n, Entity* entities) noexcept {
-		auto& freeList = mFreeList;
 
-		std::unique_lock<std::mutex> lock(mFreeListLock);
+	template<typename Policy>
+	void TDatabase<Policy>::destroy(size_t n, Entity* entities) noexcept {
+		ThreadCache* const cache = getThreadCache();
+		bool const deferred = mDeferDestroyNotifications.load(std::memory_order_relaxed);
+
+		std::unique_lock<std::mutex> lock(mFreeListLock, std::defer_lock);
+		if (!cache) {
+			// this thread doesn't have a cache, use the shared free-list directly
+			lock.lock();
+		}
+
+		size_t destroyed = 0;
 		for (size_t i = 0; i < n; i++) {
 			if (!entities[i]) {
 				// behave like free(), ok to free null Entity.
@@ -74,36 +420,263 @@ namespace myecs {
 			// ... deleting a dead Entity will corrupt the internal state, so we protect ourselves
 			// against it. We don't guarantee anything about external state -- e.g. the listeners
 			// will be called.
-			if (isAlive(entities[i])) {
-				Entity::Type const index = entities[i].getId();
-				freeList.push_back(index);
+			// The generation is bumped with a compare-and-swap, so that if several threads destroy
+			// the same Entity, only one of them recycles its index. No ordering is needed, other
+			// threads only use the generation for isAlive() and entities work as weak references.
+			Type const index = entities[i].getId();
+			auto version = typename Policy::Generation(entities[i].mVersion);
+			if (getGen(index).compare_exchange_strong(version, nextGeneration(version), std::memory_order_relaxed)) {
+				destroyed++;
+				if (cache) {
+					if (deferred) {
+						cache->destroyed.push_back(entities[i]);
+					}
+					pushBack(cache->freed, index);
+					if (cache->freed.count == THREAD_CACHE_BLOCK) {
+						drainThreadCache(*cache);
+					}
+				}
+				else {
+					if (deferred) {
+						mDestroyed.push_back(entities[i]);
+					}
+					pushBack(mFreeList, index);
+				}
+			}
+		}
 
-				// The generation update doesn't require the lock because it's only used for isAlive()
-				// and entities work as weak references -- it just means that isAlive() could return
-				// true a little longer than expected in some other threads.
-				// We do need a memory fence though, it is provided by the mFreeListLock.unlock() below.
-				getGen(index)++;
+		if (cache) {
+			addExclusive(cache->counters.destroyed, destroyed);
+		}
+		else {
+			mCounters.destroyed.fetch_add(destroyed, std::memory_order_relaxed);
+			mFreeListSize.store(mFreeList.count, std::memory_order_relaxed);
+			lock.unlock();
+		}
 
-			}
+		if (deferred) {
+			return;
 		}
-		lock.unlock();
 
 		// notify our listeners that some entities are being destroyed
-		auto listeners = getListeners();
-		for (auto const& l : listeners) {
-			l->onEntitiesDestroyed(n, entities);
+		notifyListeners(n, entities);
+	}
+
+	template<typename Policy>
+	typename TDatabase<Policy>::Stats TDatabase<Policy>::getStats() const noexcept {
+		Stats stats;
+		size_t destroyed = 0;
+		auto const accumulate = [&](Counters const& counters) {
+			stats.created += counters.created.load(std::memory_order_relaxed);
+			stats.recycled += counters.recycled.load(std::memory_order_relaxed);
+			destroyed += counters.destroyed.load(std::memory_order_relaxed);
+		};
+		accumulate(mCounters);
+		for (size_t i = 0; i < THREAD_CACHE_COUNT; i++) {
+			accumulate(mThreadCaches[i].counters);
+		}
+		// we may see a destroy() but not the create() it followed
+		stats.alive = stats.created > destroyed ? stats.created - destroyed : 0;
+		return stats;
+	}
+
+	template<typename Policy>
+	bool TDatabase<Policy>::reviveRange() noexcept {
+		std::lock_guard<std::mutex> const lock(mFreeListLock);
+		if (mDecommittedRanges.empty()) {
+			return false;
+		}
+		Type const first = mDecommittedRanges.back() << MIN_VER_SHIFT;
+		mDecommittedRanges.pop_back();
+		// their generations are 0, so they restart at 1 like fresh indices
+		for (Type index = first; index < first + MIN_VER_COUNT; index++) {
+			pushBack(mFreeList, index);
+		}
+		mFreeListSize.store(mFreeList.count, std::memory_order_relaxed);
+		return true;
+	}
+
+	template<typename Policy>
+	size_t TDatabase<Policy>::trim() noexcept {
+		size_t released = 0;
+#if MYECS_HAS_VIRTUAL_MEMORY
+		if constexpr (VIRTUAL_MEMORY) {
+			std::lock_guard<std::mutex> const lock(mFreeListLock);
+			auto& freeList = mFreeList;
+
+			// nobody is using the thread caches right now, gather all free indices in one list
+			for (size_t i = 0; i < THREAD_CACHE_COUNT; i++) {
+				append(freeList, mThreadCaches[i].recycled);
+				append(freeList, mThreadCaches[i].freed);
+			}
+
+			// count the free indices of each range that was entirely handed out. The first range
+			// holds the reserved index 0, so it's never entirely free.
+			size_t const rangeCount = std::min<size_t>(
+				mCurrentIndex.load(std::memory_order_relaxed), RAW_INDEX_COUNT) >> MIN_VER_SHIFT;
+			std::vector<uint32_t> freeCounts(rangeCount);
+			for (Type index = freeList.head; index; index = getNext(index)) {
+				if ((index >> MIN_VER_SHIFT) < rangeCount) {
+					freeCounts[index >> MIN_VER_SHIFT]++;
+				}
+			}
+
+			// take the indices of the free ranges out of the free-list
+			FreeList kept;
+			for (Type index = freeList.head; index;) {
+				Type const next = getNext(index);
+				size_t const range = index >> MIN_VER_SHIFT;
+				if (range >= rangeCount || freeCounts[range] != MIN_VER_COUNT) {
+					pushBack(kept, index);
+				}
+				index = next;
+			}
+			freeList = kept;
+			mFreeListSize.store(freeList.count, std::memory_order_relaxed);
+
+			for (size_t range = 0; range < rangeCount; range++) {
+				if (freeCounts[range] == MIN_VER_COUNT) {
+					size_t const gensSize = MIN_VER_COUNT * sizeof(Generation);
+					size_t const nextSize = MIN_VER_COUNT * sizeof(Type);
+					decommit(reinterpret_cast<char*>(mGens) + range * gensSize, gensSize);
+					decommit(reinterpret_cast<char*>(mNext) + range * nextSize, nextSize);
+					mDecommittedRanges.push_back(Type(range));
+					released += gensSize + nextSize;
+				}
+			}
+		}
+#endif
+		return released;
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::setDeferredDestroyNotifications(bool enabled) noexcept {
+		if (!mDeferDestroyNotifications.exchange(enabled, std::memory_order_relaxed) || enabled) {
+			return;
+		}
+		flushDestroyed();
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::flushDestroyed() noexcept {
+		auto& batch = mDestroyedBatch;
+		batch.clear();
+		for (size_t i = 0; i < THREAD_CACHE_COUNT; i++) {
+			auto& destroyed = mThreadCaches[i].destroyed;
+			batch.insert(batch.end(), destroyed.begin(), destroyed.end());
+			destroyed.clear();
+		}
+		{
+			std::lock_guard<std::mutex> const lock(mFreeListLock);
+			batch.insert(batch.end(), mDestroyed.begin(), mDestroyed.end());
+			mDestroyed.clear();
 		}
+		if (batch.empty()) {
+			return;
+		}
+
+		// sorted so that listeners can process the batch in a single pass over their storage
+		std::sort(batch.begin(), batch.end(), [](Entity lhs, Entity rhs) {
+			return lhs.getId() < rhs.getId();
+		});
+
+		notifyListeners(batch.size(), batch.data());
 	}
 
-	void Database::registerListener(Database::Listener* l) noexcept {
+	template<typename Policy>
+	void TDatabase<Policy>::notifyListeners(size_t n, Entity const* entities) noexcept {
+		// without listeners there is no snapshot to protect, don't touch the shared counters
+		if (!mListeners.load(std::memory_order_relaxed)) {
+			return;
+		}
+		// sequentially consistent, so that a reader counted after publishListeners() checked its
+		// slot loads the new snapshot
+		auto& readers = mListenerReaders[mListenerEpoch.load() & 1u];
+		readers.fetch_add(1);
+		ListenerArray const* const listeners = mListeners.load();
+		if (listeners) {
+			for (Listener* l : listeners->listeners) {
+				l->onEntitiesDestroyed(n, entities);
+			}
+		}
+		readers.fetch_sub(1, std::memory_order_release);
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::publishListeners(std::vector<Listener*> listeners) noexcept {
+		ListenerArray const* const array = listeners.empty() ? nullptr : new ListenerArray{ std::move(listeners) };
+		ListenerArray const* const retired = mListeners.exchange(array);
+
+		// a reader may have picked its slot before the previous flip, so drain both
+		for (int i = 0; i < 2; i++) {
+			auto const& readers = mListenerReaders[mListenerEpoch.fetch_add(1) & 1u];
+			while (readers.load() != 0) {
+				std::this_thread::yield();
+			}
+		}
+		delete retired;
+	}
+
+	template<typename Policy>
+	void TDatabase<Policy>::registerListener(Listener* l) noexcept {
 		std::lock_guard<std::mutex> const lock(mListenerLock);
-		mListeners.insert(l);
+		ListenerArray const* const current = mListeners.load(std::memory_order_relaxed);
+		std::vector<Listener*> listeners;
+		if (current) {
+			if (std::find(current->listeners.begin(), current->listeners.end(), l) != current->listeners.end()) {
+				return;
+			}
+			listeners = current->listeners;
+		}
+		listeners.push_back(l);
+		publishListeners(std::move(listeners));
 	}
 
-	void Database::unregisterListener(Database::Listener* l) noexcept {
+	template<typename Policy>
+	void TDatabase<Policy>::unregisterListener(Listener* l) noexcept {
 		std::lock_guard<std::mutex> const lock(mListenerLock);
-		mListeners.erase(l);
+		ListenerArray const* const current = mListeners.load(std::memory_order_relaxed);
+		if (current) {
+			std::vector<Listener*> listeners(current->listeners);
+			auto const pos = std::find(listeners.begin(), listeners.end(), l);
+			if (pos != listeners.end()) {
+				listeners.erase(pos);
+				publishListeners(std::move(listeners));
+			}
+		}
 	}
 
+	template<typename Policy>
+	size_t TDatabase<Policy>::trimComponents(size_t budget) {
+		// visit the sets in TypeID order, starting with the cursor
+		std::vector<uint32_t> ids;
+		ids.reserve(mComponentSets.size());
+		for (auto const& [id, set] : mComponentSets) {
+			if (set) {
+				ids.push_back(id);
+			}
+		}
+		if (ids.empty()) {
+			return 0;
+		}
+		std::sort(ids.begin(), ids.end());
+		size_t const first = size_t(std::lower_bound(ids.begin(), ids.end(), mTrimCursor) - ids.begin());
+
+		size_t copied = 0;
+		for (size_t k = 0; k < ids.size(); k++) {
+			uint32_t const id = ids[(first + k) % ids.size()];
+			if (k && copied >= budget) {
+				mTrimCursor = id;
+				return copied;
+			}
+			copied += mComponentSets[id]->trim();
+		}
+		// all the sets were visited, start over next time
+		mTrimCursor = 0;
+		return copied;
+	}
 
-}
\ No newline at end of file
+	template class TDatabase<EntityPolicy32>;
+	template class TDatabase<EntityPolicy64>;
+	template class TDatabase<EntityPolicy64Wide>;
+}
@@ -8,15 +8,30 @@
 
 #include "Entity.h"
 
-#include <deque>
+#include <utils/compiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <assert.h>
 
+// platforms where address space can be reserved up-front and committed on first touch
+#if defined(__linux__) || defined(__APPLE__)
+#   define MYECS_HAS_VIRTUAL_MEMORY 1
+#else
+#   define MYECS_HAS_VIRTUAL_MEMORY 0
+#endif
+
 namespace myecs {
 
-	class Database {
+	template<typename Policy>
+	class TDatabase {
 	public:
+		using Entity = TEntity<Policy>;
 
 		class Listener {
 		public:
@@ -25,18 +40,48 @@ namespace myecs {
 			virtual ~Listener() noexcept;
 		};
 
-		static constexpr const int GENERATION_SHIFT = 24;
-		static constexpr const size_t RAW_INDEX_COUNT = (1 << GENERATION_SHIFT);
-		static constexpr const Entity::Type INDEX_MASK = (1 << GENERATION_SHIFT) - 1u;
+		using Type = typename Policy::Type;
+
+		static constexpr const int GENERATION_SHIFT = Policy::INDEX_BITS;
+		static constexpr const size_t RAW_INDEX_COUNT = (size_t(1) << GENERATION_SHIFT);
+		static constexpr const Type INDEX_MASK = (Type(1) << GENERATION_SHIFT) - 1u;
+		static constexpr const Type GENERATION_MASK = (Type(1) << Policy::GENERATION_BITS) - 1u;
+
+		// Generations are stored in pages of MIN_VER_COUNT indices. Wide indices use larger pages
+		// so that the page directory stays reasonably small.
+		static constexpr const int MIN_VER_SHIFT = std::max(16, (GENERATION_SHIFT + 1) / 2);
+		static constexpr const size_t MIN_VER_COUNT = (size_t(1) << MIN_VER_SHIFT);
+		static constexpr const size_t MIN_VER_MASK = MIN_VER_COUNT - 1u;
 
-		static constexpr const int MIN_VER_SHIFT = 16;
-		static constexpr const size_t MIN_VER_COUNT = (1 << 16);
-		static constexpr const size_t MIN_VER_MASK = 0xffff;
-		
 		static_assert(MIN_VER_SHIFT <= GENERATION_SHIFT);
 
-		Database();
-		~Database();
+		// In virtual-memory mode the generations and free-list links of all indices are flat
+		// arrays reserved up-front, which the OS commits on first touch. isAlive() is then a
+		// single load and trim() can give memory back. Otherwise they're stored in pages of
+		// MIN_VER_COUNT indices allocated as needed. Only small tables, like the 32-bits one, are
+		// reserved: a reservation of several GB fails under address-space limits (ulimit -v,
+		// containers, strict overcommit), and there is no fallback at runtime.
+		static constexpr const bool VIRTUAL_MEMORY = MYECS_HAS_VIRTUAL_MEMORY && sizeof(void*) == 8 &&
+			uint64_t(RAW_INDEX_COUNT) * (sizeof(typename Policy::Generation) + sizeof(Type)) <= (uint64_t(1) << 30);
+
+		// number of threads that get their own cache of recycled indices, other threads go
+		// through the shared free-list directly.
+		static constexpr const size_t THREAD_CACHE_COUNT = 64;
+
+		// indices move between a thread's cache and the shared free-list in blocks of this size,
+		// so mFreeListLock is taken at most once every THREAD_CACHE_BLOCK create() or destroy().
+		static constexpr const size_t THREAD_CACHE_BLOCK = 128;
+
+		// default number of freed indices that must be waiting in the free-list before they
+		// start being recycled.
+		static constexpr const size_t MIN_FREE_INDICES = 1024;
+
+		// Freed indices are recycled in FIFO order, and only once more than minFreeIndices of them
+		// are waiting. A longer free-list delays the wrap-around of each index's generation.
+		// The indices a thread freed count as soon as that thread creates entities, those freed
+		// by other threads once they reach the shared free-list, THREAD_CACHE_BLOCK at a time.
+		explicit TDatabase(size_t minFreeIndices = MIN_FREE_INDICES);
+		~TDatabase();
 
 		// maximum number of entities that can exist at the same time
 		static size_t getMaxEntityCount() noexcept {
@@ -44,16 +89,25 @@ namespace myecs {
 			return RAW_INDEX_COUNT - 1;
 		}
 
+		struct Stats {
+			// entities currently alive
+			size_t alive = 0;
+			// entities created so far, recycled or not
+			size_t created = 0;
+			// entities created by recycling the index of a destroyed one
+			size_t recycled = 0;
+		};
+
+		// Wait-free. While other threads create or destroy entities, the counts are only
+		// approximately consistent with each other.
+		Stats getStats() const noexcept;
+
 		size_t getEntityCount() const noexcept {
-			std::lock_guard<std::mutex> const lock(mFreeListLock);
-			if (mCurrentIndex < RAW_INDEX_COUNT) {
-				return (mCurrentIndex - 1) - mFreeList.size();
-			}
-			else {
-				return getMaxEntityCount() - mFreeList.size();
-			}
+			return getStats().alive;
 		}
-		// Create a new Entity. Thread safe.
+
+		// Create a new Entity. Thread safe, and lock-free unless the calling thread's cache of
+		// recycled indices needs to be refilled.
 		// Return Entity.isNull() if the entity cannot be allocated.
 		Entity create() {
 			Entity e;
@@ -66,29 +120,84 @@ namespace myecs {
 			destroy(1, &e);
 		}
 
+		// Thread safe and lock-free. The generation is a relaxed load, and in paged mode the page
+		// lookup an acquire one, both are plain loads on x86 and ARMv8.
 		bool isAlive(Entity e) const noexcept {
 			assert(e.getId() < RAW_INDEX_COUNT);
-			return (!e.isNull()) && (e.mVersion == getGen(e.getId()));
+			if (e.isNull()) {
+				return false;
+			}
+			if constexpr (VIRTUAL_MEMORY) {
+				// untouched or decommitted indices read as 0, which is never a valid generation
+				return e.mVersion == mGens[e.getId()].load(std::memory_order_relaxed);
+			}
+			Page const* const page = mPages[e.getId() >> MIN_VER_SHIFT].load(std::memory_order_acquire);
+			// an unpublished page means the index was never handed out
+			return page && (e.mVersion == page->gens[e.getId() & MIN_VER_MASK].load(std::memory_order_relaxed));
 		}
 		
+		// Batched isAlive(): bit (i % 64) of aliveMask[i / 64] is set if entities[i] is alive, the
+		// other bits are cleared. aliveMask must hold (n + 63) / 64 words.
+		// Thread safe and lock-free, generations are gathered 8 at a time when AVX2 is available.
+		void isAlive(size_t n, Entity const* entities, uint64_t* aliveMask) const noexcept;
+
+		// Writes the entities that are alive to out, in order, and returns how many there are.
+		// out can be the same as entities, to compact an array in place.
+		size_t filterAlive(size_t n, Entity const* entities, Entity* out) const noexcept;
+
 		void create(size_t n, Entity* entities);
 		
 		void destroy(size_t n, Entity* entities) noexcept;
 
-		void registerListener(Database::Listener* l) noexcept;
-		void unregisterListener(Database::Listener* l) noexcept;
+		// Registering and unregistering copy the list of listeners, destroy() only reads it and
+		// never locks. Both wait for the destroy() and flushDestroyed() calls already notifying
+		// to finish, so once unregisterListener() returns the listener isn't called anymore and
+		// can be deleted. They must not be called from a listener.
+		void registerListener(Listener* l) noexcept;
+		void unregisterListener(Listener* l) noexcept;
+
+		// When enabled, destroy() doesn't notify the listeners, it only records the entities it
+		// destroyed. They're delivered at the next flushDestroyed() in a single batch sorted by id.
+		// Disabling flushes what's pending.
+		void setDeferredDestroyNotifications(bool enabled) noexcept;
+
+		bool isDeferringDestroyNotifications() const noexcept {
+			return mDeferDestroyNotifications.load(std::memory_order_relaxed);
+		}
+
+		// Notifies the listeners of all the entities destroyed since the last call. This is a sync
+		// point: it must not run concurrently with destroy().
+		void flushDestroyed() noexcept;
+
+		// Gives back the memory used by ranges of MIN_VER_COUNT indices that are all free, and
+		// returns how many bytes were released. Handles to these indices stay dead, and the
+		// indices are only handed out again once all the others are in use; their generation then
+		// starts over, which like a wrap-around can make very old handles look alive again.
+		// This is a sync point: it must not run concurrently with create() or destroy().
+		// Only virtual-memory mode releases memory, this does nothing otherwise.
+		size_t trim() noexcept;
+
+		// Trims the component sets one after the other (see ComponentSet::trim()) until budget
+		// rows have been copied, and carries on from there on the next call, so that the
+		// reallocations following a mass destruction are spread over several frames. At least
+		// one set is trimmed per call. Returns the number of rows copied.
+		// Nothing may use the component sets during the call.
+		size_t trimComponents(size_t budget = 65536);
 	
 		template<typename T>
 		T& get() {
 			return *(T*)mComponentSets[T::TypeID].get();
 		}
 
+		// Component sets that are also a Listener of this Database (see
+		// ComponentTraits::REMOVE_ON_DESTROY) are registered when created. They're notified on the
+		// thread calling destroy(), so destroying from several threads needs deferred
+		// notifications, see setDeferredDestroyNotifications().
 		template<typename T>
 		T* getPtr() {
 			auto set = (T*)mComponentSets[T::TypeID].get();
 			if (set == nullptr) {
-				mComponentSets[T::TypeID] = make_unique<T>();
-				return (T*)mComponentSets[T::TypeID].get();
+				return createComSet<T>();
 			}
 			return set;
 		}
@@ -97,40 +206,226 @@ namespace myecs {
 		void addComSet() {
 			auto set = (T*)mComponentSets[T::TypeID].get();
 			assert(set == nullptr);
-			mComponentSets[T::TypeID] = make_unique<T>();
+			createComSet<T>();
 		}
 
 	private:
 
-		uint8_t getGen(uint32_t index) const {
-			return mGens[index >> MIN_VER_SHIFT][index & MIN_VER_MASK];
+		template<typename T>
+		T* createComSet() {
+			mComponentSets[T::TypeID] = std::make_unique<T>();
+			auto set = (T*)mComponentSets[T::TypeID].get();
+			if constexpr (std::is_base_of_v<Listener, T>) {
+				registerListener(set);
+			}
+			return set;
 		}
 
-		uint8_t& getGen(uint32_t index) {
-			return mGens[index >> MIN_VER_SHIFT][index & MIN_VER_MASK];
+		using Generation = std::atomic<typename Policy::Generation>;
+
+		// Per-index storage, allocated and published a page at a time when not in virtual-memory
+		// mode
+		struct Page {
+			// generation of each index
+			Generation gens[MIN_VER_COUNT];
+			// next index in the free-list holding this index, 0 terminates the list
+			Type next[MIN_VER_COUNT];
+		};
+
+		// A FIFO list of free indices, linked through getNext(). An index is in at most one list.
+		struct FreeList {
+			Type head = 0;
+			Type tail = 0;
+			size_t count = 0;
+		};
+
+		// Running totals for getStats(). The counters of a ThreadCache have a single writer and
+		// are updated with a plain load and store, the shared ones with a fetch_add.
+		struct Counters {
+			std::atomic<size_t> created{ 0 };
+			std::atomic<size_t> recycled{ 0 };
+			std::atomic<size_t> destroyed{ 0 };
+		};
+
+		// Recycled indices owned by a single thread. Only that thread touches the lists and
+		// writes the counters.
+		struct alignas(64) ThreadCache {
+			// indices taken from the shared free-list, ready to be handed out by create()
+			FreeList recycled;
+			// indices freed by destroy(), appended to the shared free-list a block at a time
+			FreeList freed;
+			Counters counters;
+			// entities destroyed by this thread, waiting for flushDestroyed()
+			std::vector<Entity> destroyed;
+		};
+
+		// returns the cache owned by the calling thread, or nullptr if all caches are taken
+		ThreadCache* getThreadCache() const noexcept;
+
+		// moves a block of indices from the shared free-list to the cache, returns false if
+		// there was nothing to recycle.
+		bool refillThreadCache(ThreadCache& cache) noexcept;
+
+		// appends the indices freed by this thread to the shared free-list
+		void drainThreadCache(ThreadCache& cache) noexcept;
+
+		// true if indices can be recycled from a free-list of this size
+		bool canRecycle(size_t freeCount) const noexcept {
+			// once all indices have been used, recycling is the only option left
+			return freeCount > mMinFreeIndices ||
+				(freeCount && mCurrentIndex.load(std::memory_order_relaxed) >= RAW_INDEX_COUNT);
+		}
+
+		void pushBack(FreeList& list, Type index) noexcept {
+			getNext(index) = 0;
+			if (list.tail) {
+				getNext(list.tail) = index;
+			}
+			else {
+				list.head = index;
+			}
+			list.tail = index;
+			list.count++;
+		}
+
+		Type popFront(FreeList& list) noexcept {
+			assert(list.count);
+			Type const index = list.head;
+			list.head = getNext(index);
+			if (--list.count == 0) {
+				list.tail = 0;
+			}
+			return index;
+		}
+
+		// moves all of other at the end of list
+		void append(FreeList& list, FreeList& other) noexcept {
+			if (other.count) {
+				if (list.tail) {
+					getNext(list.tail) = other.head;
+				}
+				else {
+					list.head = other.head;
+				}
+				list.tail = other.tail;
+				list.count += other.count;
+				other = {};
+			}
+		}
+
+		// makes sure the pages covering [first, last) are allocated and published
+		void ensurePages(Type first, Type last);
+
+		// once all indices have been used, puts the indices of a range released by trim() back in
+		// the shared free-list. Returns false if there was none.
+		bool reviveRange() noexcept;
+
+		// the page holding this index must have been published
+		Page& getPage(Type index) const noexcept {
+			Page* const page = mPages[index >> MIN_VER_SHIFT].load(std::memory_order_acquire);
+			assert(page);
+			return *page;
+		}
+
+		Generation& getGen(Type index) const noexcept {
+			if constexpr (VIRTUAL_MEMORY) {
+				return mGens[index];
+			}
+			else {
+				return getPage(index).gens[index & MIN_VER_MASK];
+			}
+		}
+
+		Type& getNext(Type index) const noexcept {
+			if constexpr (VIRTUAL_MEMORY) {
+				return mNext[index];
+			}
+			else {
+				return getPage(index).next[index & MIN_VER_MASK];
+			}
 		}
 
-		std::vector<Listener*> getListeners() const noexcept {
-			std::lock_guard<std::mutex> const lock(mListenerLock);
-			auto const& listeners = mListeners;
-			std::vector<Listener*> result((uint32_t)listeners.size());
-			result.resize(result.capacity()); // unfortunately this memset()
-			std::copy(listeners.begin(), listeners.end(), result.begin());
-			return result; // the c++ standard guarantees a move
+		// Generations start at 1 and skip 0 when they wrap around, so that zeroed memory never
+		// matches a handle.
+		static typename Policy::Generation nextGeneration(typename Policy::Generation version) noexcept {
+			auto const next = typename Policy::Generation((version + 1u) & GENERATION_MASK);
+			return next ? next : 1;
 		}
 
-		uint32_t mCurrentIndex = 1;
+		Entity makeEntity(Type index) noexcept {
+			Generation& gen = getGen(index);
+			auto version = gen.load(std::memory_order_relaxed);
+			if (UTILS_UNLIKELY(version == 0)) {
+				// first time this index is used
+				version = 1;
+				gen.store(version, std::memory_order_relaxed);
+			}
+			return Entity{ index, version };
+		}
+
+		// An immutable snapshot of the registered listeners
+		struct ListenerArray {
+			std::vector<Listener*> listeners;
+		};
+
+		// replaces the current snapshot and frees the previous one once no notification reads it,
+		// mListenerLock must be held
+		void publishListeners(std::vector<Listener*> listeners) noexcept;
+
+		// calls onEntitiesDestroyed() on each listener of the current snapshot
+		void notifyListeners(size_t n, Entity const* entities) noexcept;
+
+		// next never-used index, bumped without a lock by create()
+		std::atomic<Type> mCurrentIndex{ 1 };
 
-		// stores indices that got freed
+		// stores indices that got freed and that are not cached by a thread
 		mutable std::mutex mFreeListLock;
-		std::deque<Entity::Type> mFreeList;
+		FreeList mFreeList;
+		// mFreeList.count, readable without holding mFreeListLock
+		std::atomic<size_t> mFreeListSize{ 0 };
+		size_t const mMinFreeIndices;
+
+		// counters of the threads without a cache
+		Counters mCounters;
+
+		// entities destroyed by threads without a cache, waiting for flushDestroyed(). Guarded by
+		// mFreeListLock.
+		std::vector<Entity> mDestroyed;
+		// reused by flushDestroyed()
+		std::vector<Entity> mDestroyedBatch;
+		std::atomic<bool> mDeferDestroyNotifications{ false };
 
-		mutable std::mutex  mListenerLock;
-		robin_hood::unordered_set<Listener*> mListeners;
+		std::unique_ptr<ThreadCache[]> mThreadCaches;
 
-		// stores the generation of each index.
-		uint8_t** mGens = nullptr;
+		// Current snapshot, nullptr when there are no listeners.
+		std::atomic<ListenerArray const*> mListeners{ nullptr };
+		std::mutex mListenerLock;
+		// Notifications count themselves in the slot of the current epoch while they read a
+		// snapshot. publishListeners() flips the epoch twice, waiting each time for the previous
+		// slot to drain, after which no notification can hold the replaced snapshot.
+		std::atomic<uint32_t> mListenerEpoch{ 0 };
+		std::atomic<uint32_t> mListenerReaders[2] = {};
+
+		// stores the generation and free-list link of each index. Pages are published with a
+		// release store once fully initialized, and never freed until the Database is destroyed.
+		std::atomic<Page*>* mPages = nullptr;
+
+		// in virtual-memory mode, the generation and free-list link of each index
+		Generation* mGens = nullptr;
+		Type* mNext = nullptr;
+
+		// ranges released by trim(). Guarded by mFreeListLock.
+		std::vector<Type> mDecommittedRanges;
 
 		robin_hood::unordered_map<uint32_t, std::unique_ptr<ComponentSet>> mComponentSets;
+		// TypeID of the component set the next trimComponents() starts with
+		uint32_t mTrimCursor = 0;
 	};
+
+	// the implementation lives in Database.cpp, for these handle layouts only
+	extern template class TDatabase<EntityPolicy32>;
+	extern template class TDatabase<EntityPolicy64>;
+	extern template class TDatabase<EntityPolicy64Wide>;
+
+	using Database = TDatabase<EntityPolicy32>;
 }
\ No newline at end of file
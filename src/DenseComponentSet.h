@@ -2,6 +2,10 @@
 #include <utils/StructureOfArrays.h>
 #include "ComponentSet.h"
 
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
 namespace myecs {
 	
     
@@ -11,33 +15,42 @@ namespace myecs {
 		Instance index = 0;
 	};
 
-	template <typename ... Elements>
-	class DenseComponentSet : public ComponentSet {
+	// Allocator allocates the columns, see utils/Allocator.h
+	template <typename Allocator, typename ... Elements>
+	class TBasicDenseComponentSet : public ComponentSet {
 	protected:
 		static constexpr size_t ENTITY_INDEX = sizeof ... (Elements);
 	public:
 		inline static int TypeID = getComponentSetType();
 
-		using SoA = utils::StructureOfArrays<Elements ..., Indexable*>;
+		using SoA = utils::StructureOfArraysBase<Allocator, Elements ..., Indexable*>;
 
 		using Structure = typename SoA::Structure;
 
 		using Instance = Indexable::Instance;
 
-		DenseComponentSet() noexcept {
+		TBasicDenseComponentSet() noexcept {
 			// We always start with a dummy entry because index=0 is reserved. The component
 			// at index = 0, is guaranteed to be default-initialized.
 			// Sub-classes can use this to their advantage.
 			mData.push_back(Structure{});
 		}
 
-		DenseComponentSet(DenseComponentSet&&) noexcept {/* = default */ }
-		DenseComponentSet& operator=(DenseComponentSet&&) noexcept {/* = default */ }
-		~DenseComponentSet() noexcept = default;
+		// For allocators that are handles to an arena or a pool. With a capacity, the columns are
+		// allocated once, as SoA::getNeededSize(capacity + 1) bytes. Like for component managers,
+		// growing past a Pool's block size fails with std::bad_alloc.
+		explicit TBasicDenseComponentSet(Allocator const& allocator, size_t capacity = 0)
+			: mData(capacity + 1, allocator) {
+			mData.push_back(Structure{});
+		}
+
+		TBasicDenseComponentSet(TBasicDenseComponentSet&&) noexcept {/* = default */ }
+		TBasicDenseComponentSet& operator=(TBasicDenseComponentSet&&) noexcept {/* = default */ }
+		~TBasicDenseComponentSet() noexcept = default;
 
 		// not copyable
-		DenseComponentSet(DenseComponentSet const& rhs) = delete;
-		DenseComponentSet& operator=(DenseComponentSet const& rhs) = delete;
+		TBasicDenseComponentSet(TBasicDenseComponentSet const& rhs) = delete;
+		TBasicDenseComponentSet& operator=(TBasicDenseComponentSet const& rhs) = delete;
 
 
 		// returns true if the given Entity has a component of this Manager
@@ -61,6 +74,11 @@ namespace myecs {
 			return getComponentCount() == 0;
 		}
 
+		// number of components the arrays hold without growing
+		size_t getCapacity() const noexcept {
+			return mData.capacity() - 1;
+		}
+
 		Indexable* const* getEntities() const noexcept {
 			return data<ENTITY_INDEX>() + 1;
 		}
@@ -78,6 +96,29 @@ namespace myecs {
 		// This invalidates all pointers components.
 		inline Instance removeComponent(Indexable* e);
 
+		// Adds a component to each of the n given entities and writes their instances to out,
+		// like addComponent() would. Capacity is reserved once for all of them.
+		// This invalidates all pointers components.
+		inline void addComponents(size_t n, Indexable* const* entities, Instance* out);
+
+		// Removes the components of the n given entities, like removeComponent() would. The
+		// holes are sorted and filled from the end of the arrays in a single pass.
+		// This invalidates all pointers components.
+		inline void removeComponents(size_t n, Indexable* const* entities);
+
+		// Once less than 1/SoA::SHRINK_RATIO of the capacity is used, reallocates the arrays to
+		// fit. Returns the number of rows copied, 0 if the capacity was kept.
+		// This invalidates all pointers components.
+		size_t trim() override {
+			return mData.trim() ? mData.size() : 0;
+		}
+
+		// Like trim(), regardless of how much of the capacity is used.
+		// This invalidates all pointers components.
+		void shrinkToFit() {
+			mData.shrinkToFit();
+		}
+
 		// return the first instance
 		Instance begin() const noexcept { return 1u; }
 
@@ -140,7 +181,7 @@ namespace myecs {
 		// We need our own version of Field because mData is private
 		template<size_t E>
 		struct Field : public SoA::template Field<E> {
-			Field(DenseComponentSet& soa, Indexable::Instance i) noexcept
+			Field(TBasicDenseComponentSet& soa, Indexable::Instance i) noexcept
 				: SoA::template Field<E>{ soa.mData, i } {
 			}
 			using SoA::template Field<E>::operator =;
@@ -179,10 +220,13 @@ namespace myecs {
 		SoA mData;
 	};
 	
+	template <typename ... Elements>
+	using DenseComponentSet = TBasicDenseComponentSet<utils::HeapAllocator, Elements ...>;
+
 	// Keep these outside of the class because CLion has trouble parsing them
-	template<typename ... Elements>
-	typename DenseComponentSet<Elements ...>::Instance
-		DenseComponentSet<Elements ...>::addComponent(Indexable* e) {
+	template<typename Allocator, typename ... Elements>
+	typename TBasicDenseComponentSet<Allocator, Elements ...>::Instance
+		TBasicDenseComponentSet<Allocator, Elements ...>::addComponent(Indexable* e) {
 		Instance ci = 0;
 		if (e) {
 			if (!hasComponent(e)) {
@@ -202,11 +246,12 @@ namespace myecs {
 	}
 
 	// Keep these outside of the class because CLion has trouble parsing them
-	template <typename ... Elements>
-	typename DenseComponentSet<Elements ...>::Instance
-		DenseComponentSet<Elements ... >::removeComponent(Indexable* e) {
+	template <typename Allocator, typename ... Elements>
+	typename TBasicDenseComponentSet<Allocator, Elements ...>::Instance
+		TBasicDenseComponentSet<Allocator, Elements ...>::removeComponent(Indexable* e) {
 		size_t index = e->index;
 		if (index !=0 ) {// pos->second;
+			e->index = 0;
 			size_t last = mData.size() - 1;
 			if (last != index) {
 				// move the last item to where we removed this component, as to keep
@@ -224,4 +269,45 @@ namespace myecs {
 		return 0;
 	}
 
+	template<typename Allocator, typename ... Elements>
+	void TBasicDenseComponentSet<Allocator, Elements ...>::addComponents(size_t n, Indexable* const* entities, Instance* out) {
+		// new rows are numbered now, and created all at once below
+		Instance const base = Instance(mData.size());
+		Instance next = base;
+		for (size_t i = 0; i < n; i++) {
+			Indexable* const e = entities[i];
+			Instance ci = 0;
+			if (e) {
+				ci = e->index;
+				if (!ci) {
+					ci = next++;
+					e->index = ci;
+				}
+			}
+			out[i] = ci;
+		}
+
+		if (next != base) {
+			mData.resizeZeroed(next);
+			mData.template assignNewRows<ENTITY_INDEX>(base, n, entities, out);
+		}
+	}
+
+	template<typename Allocator, typename ... Elements>
+	void TBasicDenseComponentSet<Allocator, Elements ...>::removeComponents(size_t n, Indexable* const* entities) {
+		std::vector<Instance> holes;
+		holes.reserve(n);
+		for (size_t i = 0; i < n; i++) {
+			Indexable* const e = entities[i];
+			if (e && e->index) {
+				holes.push_back(e->index);
+				e->index = 0;
+			}
+		}
+		std::sort(holes.begin(), holes.end());
+		mData.eraseSorted(holes.data(), holes.size(), [this](size_t hole) {
+			mData.template elementAt<ENTITY_INDEX>(hole)->index = Instance(hole);
+		});
+	}
+
 }
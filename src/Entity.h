@@ -1,32 +1,66 @@
 #pragma once
 #include "ComponentSet.h"
 
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
 namespace myecs {
 
-	struct Entity {
+	// Layout of an Entity handle: the low IndexBits of a T are the index, the remaining bits are
+	// the generation, which is bumped every time the index is recycled.
+	template<typename T, int IndexBits>
+	struct EntityPolicy {
+		static_assert(std::is_unsigned_v<T>);
+		static_assert(IndexBits > 0 && IndexBits < int(sizeof(T) * 8));
+
+		using Type = T;
+
+		static constexpr const int INDEX_BITS = IndexBits;
+		static constexpr const int GENERATION_BITS = int(sizeof(T) * 8) - IndexBits;
+
+		// smallest type that can hold an index
+		using Id = std::conditional_t<(IndexBits <= 32), uint32_t, uint64_t>;
+
+		// smallest type that can hold a generation
+		using Generation = std::conditional_t<(GENERATION_BITS <= 8), uint8_t,
+			std::conditional_t<(GENERATION_BITS <= 16), uint16_t, uint32_t>>;
+	};
+
+	// 16M entities, the generation wraps after 256 recycles of an index.
+	using EntityPolicy32 = EntityPolicy<uint32_t, 24>;
+
+	// 4G entities, the generation wraps after 4G recycles of an index.
+	using EntityPolicy64 = EntityPolicy<uint64_t, 32>;
+
+	// 1T entities, the generation wraps after 16M recycles of an index.
+	using EntityPolicy64Wide = EntityPolicy<uint64_t, 40>;
+
+	template<typename Policy>
+	struct TEntity {
 		// this can be used to create an array of to-be-filled entities (see create())
-		Entity() noexcept { } // NOLINT(modernize-use-equals-default), Ubuntu compiler bug
+		TEntity() noexcept { } // NOLINT(modernize-use-equals-default), Ubuntu compiler bug
 
 		// Entities can be copied
-		Entity(const Entity& e) noexcept = default;
-		Entity(Entity&& e) noexcept = default;
-		Entity& operator=(const Entity& e) noexcept = default;
-		Entity& operator=(Entity&& e) noexcept = default;
+		TEntity(const TEntity& e) noexcept = default;
+		TEntity(TEntity&& e) noexcept = default;
+		TEntity& operator=(const TEntity& e) noexcept = default;
+		TEntity& operator=(TEntity&& e) noexcept = default;
 
-		// Entities can be compared
-		bool operator==(Entity e) const { return e.mId == mId; }
-		bool operator!=(Entity e) const { return e.mId != mId; }
+		// Entities can be compared, a recycled index doesn't compare equal to its older handles
+		bool operator==(TEntity e) const { return e.mValue == mValue; }
+		bool operator!=(TEntity e) const { return e.mValue != mValue; }
 
 		// Entities can be sorted
-		bool operator<(Entity e) const { return e.mId < mId; }
+		bool operator<(TEntity e) const { return e.mId < mId; }
 
 		bool isNull() const noexcept {
 			return mId == 0;
 		}
 
 		// an id that can be used for debugging/printing
-		uint32_t getId() const noexcept {
-			return mId;
+		typename Policy::Id getId() const noexcept {
+			return typename Policy::Id(mId);
 		}
 
 		explicit operator bool() const noexcept { return !isNull(); }
@@ -34,25 +68,33 @@ namespace myecs {
 		void clear() noexcept { mValue = 0; }
 
 		struct Hasher {
-			typedef Entity argument_type;
+			typedef TEntity argument_type;
 			typedef size_t result_type;
 			result_type operator()(argument_type const& e) const {
-				return e.mValue;
+				if constexpr (sizeof(Type) > sizeof(size_t)) {
+					// keep the generation in the hash on 32-bits platforms
+					return result_type(e.mValue ^ (e.mValue >> 32));
+				}
+				else {
+					return result_type(e.mValue);
+				}
 			}
 		};
 
 	private:
-		friend class Database;
+		template<typename> friend class TDatabase;
 
-		using Type = uint32_t;
+		using Type = typename Policy::Type;
 
-		explicit Entity(Type identity, Type ver) noexcept : mId(identity), mVersion(ver) { }
+		explicit TEntity(Type identity, Type ver) noexcept : mId(identity), mVersion(ver) { }
 		union {
 			Type mValue = 0;
 			struct {
-				Type mId : 24;
-				Type mVersion : 8;
+				Type mId : Policy::INDEX_BITS;
+				Type mVersion : Policy::GENERATION_BITS;
 			};
 		};
 	};
-}
\ No newline at end of file
+
+	using Entity = TEntity<EntityPolicy32>;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "ComponentManager.h"
+#include "View.h"
+
+#include <array>
+#include <stddef.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace myecs {
+
+	// Owns several packed component managers, and keeps the entities that have a component in
+	// all of them at the front of each, in the same order: instances [1, size()] of every
+	// manager belong to the same entities. Iterating the group is then a linear walk over the
+	// columns, without any lookup:
+	//
+	//   Group<MoveObject, Health> group(moves, health);
+	//   group.forEach([](Entity e, Vec2& p, Vec2& v, float& hp) { ... });
+	//
+	// The group observes its managers, and moves rows in or out of the front as components are
+	// added and removed, so any way of adding or removing components keeps it up to date.
+	// A manager can be owned by a single group.
+	template<typename ... Managers>
+	class Group : private ManagerObserver<typename std::tuple_element_t<0, std::tuple<Managers ...>>::Entity> {
+		static constexpr size_t N = sizeof ... (Managers);
+
+	public:
+		using Entity = typename std::tuple_element_t<0, std::tuple<Managers ...>>::Entity;
+		using Instance = ComponentSet::Type;
+
+		explicit Group(Managers& ... managers) noexcept : mManagers(managers ...) {
+			static_assert(N > 1, "a group needs at least two managers");
+			static_assert((std::is_same_v<typename Managers::Entity, Entity> && ...),
+				"all the managers of a Group must use the same entities");
+			std::apply([this](auto& ... m) { (m.setObserver(this), ...); }, mManagers);
+
+			// group the entities that already have all the components
+			auto const& first = std::get<0>(mManagers);
+			for (Instance i = first.begin(); i != first.end(); i++) {
+				onComponentAdded(first.getEntity(i));
+			}
+		}
+
+		~Group() noexcept {
+			std::apply([](auto& ... m) { (m.setObserver(nullptr), ...); }, mManagers);
+		}
+
+		// not copyable
+		Group(Group const& rhs) = delete;
+		Group& operator=(Group const& rhs) = delete;
+
+		// number of entities in the group, they are at instances [1, size()] of every manager
+		size_t size() const noexcept {
+			return mSize;
+		}
+
+		bool empty() const noexcept {
+			return mSize == 0;
+		}
+
+		// Calls f(Entity, references to all the columns of every manager...) for each entity of
+		// the group.
+		// Components must not be added or removed during forEach().
+		template<typename F>
+		void forEach(F&& f) {
+			for (Instance i = 1; i <= mSize; i++) {
+				call(f, i, std::make_index_sequence<N>{});
+			}
+		}
+
+	private:
+		using Instances = std::array<Instance, N>;
+
+		void onComponentAdded(Entity e) noexcept override {
+			Instances instances;
+			if (!lookup(e, instances, std::make_index_sequence<N>{}) || instances[0] <= mSize) {
+				// not in all managers, or already grouped
+				return;
+			}
+			mSize++;
+			move(instances, Instance(mSize), std::make_index_sequence<N>{});
+		}
+
+		void onComponentRemoving(Entity e) noexcept override {
+			Instances instances;
+			if (!lookup(e, instances, std::make_index_sequence<N>{}) || instances[0] > mSize) {
+				return;
+			}
+			// swap it with the last of the group, and shrink the group
+			move(instances, Instance(mSize), std::make_index_sequence<N>{});
+			mSize--;
+		}
+
+		template<size_t ... J>
+		bool lookup(Entity e, Instances& instances, std::index_sequence<J ...>) const noexcept {
+			((instances[J] = std::get<J>(mManagers).getInstance(e)), ...);
+			return ((instances[J] != 0) && ...);
+		}
+
+		template<size_t ... J>
+		void move(Instances const& instances, Instance to, std::index_sequence<J ...>) noexcept {
+			(std::get<J>(mManagers).swapComponents(instances[J], to), ...);
+		}
+
+		template<typename F, size_t ... J>
+		void call(F& f, Instance i, std::index_sequence<J ...>) {
+			std::apply(f, std::tuple_cat(std::tuple<Entity>(std::get<0>(mManagers).getEntity(i)),
+				columns(std::get<J>(mManagers), i, typename details::ViewColumns<Managers>::Indices{}) ...));
+		}
+
+		template<typename Manager, size_t ... I>
+		static auto columns(Manager& manager, Instance i, std::index_sequence<I ...>) noexcept {
+			return std::forward_as_tuple(manager.template elementAt<I>(i) ...);
+		}
+
+		std::tuple<Managers& ...> mManagers;
+		size_t mSize = 0;
+	};
+}
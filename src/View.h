@@ -0,0 +1,151 @@
+#pragma once
+#include "ComponentSet.h"
+
+#include <utils/compiler.h>
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace myecs {
+
+	// Selects some of the columns of a manager for a View, e.g. Columns<MoveObject, 0>.
+	// A const manager gives const references.
+	template<typename Manager, size_t ... ElementIndex>
+	struct Columns {
+	};
+
+	namespace details {
+
+		// by default a View passes all the columns of a manager
+		template<typename T>
+		struct ViewColumns {
+			using Manager = T;
+			using Indices = std::make_index_sequence<std::remove_const_t<T>::SoA::getArrayCount() - 1>;
+		};
+
+		template<typename M, size_t ... ElementIndex>
+		struct ViewColumns<Columns<M, ElementIndex ...>> {
+			using Manager = M;
+			using Indices = std::index_sequence<ElementIndex ...>;
+		};
+	}
+
+	// Joins several component managers on their entities:
+	//
+	//   View<MoveObject, Columns<const Health, 0>> view(moves, health);
+	//   view.forEach([](Entity e, Vec2& p, Vec2& v, float const& hp) { ... });
+	//
+	// The manager with the fewest components drives the iteration, the others are probed
+	// through their index. Probes run a few rows ahead, so that the probed rows are prefetched by
+	// the time they're used.
+	// Components must not be added or removed during forEach().
+	template<typename ... Ts>
+	class View {
+		static constexpr size_t N = sizeof ... (Ts);
+
+		template<size_t J>
+		using ManagerAt = typename details::ViewColumns<std::tuple_element_t<J, std::tuple<Ts ...>>>::Manager;
+
+		template<size_t J>
+		using IndicesAt = typename details::ViewColumns<std::tuple_element_t<J, std::tuple<Ts ...>>>::Indices;
+
+	public:
+		static_assert(N > 0);
+
+		using Entity = typename std::remove_const_t<ManagerAt<0>>::Entity;
+		using Instance = ComponentSet::Type;
+
+		explicit View(typename details::ViewColumns<Ts>::Manager& ... managers) noexcept
+			: mManagers(managers ...) {
+			static_assert((std::is_same_v<typename std::remove_const_t<
+				typename details::ViewColumns<Ts>::Manager>::Entity, Entity> && ...),
+				"all the managers of a View must use the same entities");
+		}
+
+		// Calls f(Entity, references to the columns...) for each entity that has a component in
+		// all the managers
+		template<typename F>
+		void forEach(F&& f) {
+			dispatch(f, std::make_index_sequence<N>{});
+		}
+
+	private:
+		static constexpr size_t PREFETCH_DISTANCE = 8;
+
+		// instance in each manager, the driver's is 0 when the row must be skipped
+		using Instances = std::array<Instance, N>;
+
+		template<typename F, size_t ... J>
+		void dispatch(F& f, std::index_sequence<J ...>) {
+			size_t const counts[] = { std::get<J>(mManagers).getComponentCount() ... };
+			size_t driver = 0;
+			for (size_t k = 1; k < N; k++) {
+				if (counts[k] < counts[driver]) {
+					driver = k;
+				}
+			}
+			((driver == J ? run<J>(f) : void()), ...);
+		}
+
+		template<size_t D, typename F>
+		void run(F& f) {
+			auto const& manager = std::get<D>(mManagers);
+			Entity const* const entities = manager.getEntities();
+			size_t const count = manager.getComponentCount();
+
+			Instances ring[PREFETCH_DISTANCE];
+			for (size_t row = 0; row < count && row < PREFETCH_DISTANCE; row++) {
+				probe<D>(entities[row], Instance(row + 1), ring[row], std::make_index_sequence<N>{});
+			}
+			for (size_t row = 0; row < count; row++) {
+				Instances& instances = ring[row % PREFETCH_DISTANCE];
+				if (instances[D]) {
+					call(f, entities[row], instances, std::make_index_sequence<N>{});
+				}
+				size_t const next = row + PREFETCH_DISTANCE;
+				if (next < count) {
+					probe<D>(entities[next], Instance(next + 1), instances, std::make_index_sequence<N>{});
+				}
+			}
+		}
+
+		template<size_t D, size_t ... J>
+		void probe(Entity e, Instance instance, Instances& instances, std::index_sequence<J ...>) const noexcept {
+			// removed rows of stable managers hold the null entity
+			bool found = bool(e);
+			((instances[J] = (J == D) ? instance : (found ? std::get<J>(mManagers).getInstance(e) : 0),
+				found = found && instances[J] != 0), ...);
+			if (!found) {
+				instances[D] = 0;
+				return;
+			}
+			(prefetchColumns(std::get<J>(mManagers), instances[J], IndicesAt<J>{}), ...);
+		}
+
+		template<typename Manager, size_t ... I>
+		static void prefetchColumns(Manager const& manager, Instance i, std::index_sequence<I ...>) noexcept {
+			(prefetch(manager.template raw_array<I>() + i), ...);
+		}
+
+		static void prefetch(void const* p) noexcept {
+			UTILS_PREFETCH(p);
+		}
+
+		template<typename F, size_t ... J>
+		void call(F& f, Entity e, Instances const& instances, std::index_sequence<J ...>) {
+			std::apply(f, std::tuple_cat(std::tuple<Entity>(e),
+				columns(std::get<J>(mManagers), instances[J], IndicesAt<J>{}) ...));
+		}
+
+		template<typename Manager, size_t ... I>
+		static auto columns(Manager& manager, Instance i, std::index_sequence<I ...>) noexcept {
+			return std::forward_as_tuple(manager.template elementAt<I>(i) ...);
+		}
+
+		std::tuple<typename details::ViewColumns<Ts>::Manager& ...> mManagers;
+	};
+}
@@ -3,6 +3,10 @@
 #include "ComponentManager.h"
 #include "DenseComponentSet.h"
 #include "Database.h"
+#include "CommandBuffer.h"
+#include "View.h"
+#include "Group.h"
+#include "ArchetypeStorage.h"
 
 namespace myecs {
 
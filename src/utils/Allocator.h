@@ -0,0 +1,405 @@
+#ifndef TNT_UTILS_ALLOCATOR_H
+#define TNT_UTILS_ALLOCATOR_H
+
+#include <utils/compiler.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#if defined(__linux__) || defined(__APPLE__)
+#   define UTILS_HAS_MMAP 1
+#   include <sys/mman.h>
+#   include <unistd.h>
+#else
+#   define UTILS_HAS_MMAP 0
+#endif
+
+namespace utils {
+
+	inline void* aligned_alloc(size_t size, size_t align) noexcept {
+		// 'align' must be a power of two and a multiple of sizeof(void*)
+		align = (align < sizeof(void*)) ? sizeof(void*) : align;
+		assert(align && !(align & align - 1));
+		assert((align % sizeof(void*)) == 0);
+
+		void* p = nullptr;
+
+#if defined(WIN32)
+		p = ::_aligned_malloc(size, align);
+#else
+		::posix_memalign(&p, align, size);
+#endif
+		return p;
+	}
+
+	inline void aligned_free(void* p) noexcept {
+#if defined(WIN32)
+		::_aligned_free(p);
+#else
+		::free(p);
+#endif
+	}
+
+	// The allocators of StructureOfArraysBase provide
+	//
+	//     void* alloc(size_t size, size_t alignment);
+	//     void free(void* p, size_t size) noexcept;    // size as given to alloc(), p can be null
+	//     void swap(Allocator& rhs) noexcept;
+	//
+	// and are default constructible. Allocators drawing from an arena or a pool are handles to
+	// it, given to the StructureOfArraysBase (or component manager) constructor.
+	// Optionally, they can move pages between their allocations, see MappedAllocator:
+	//
+	//     static constexpr size_t PAGE_SIZE;
+	//     bool remap(void* dst, void* src, size_t size) noexcept;
+
+	// The arrays of a StructureOfArrays are aligned on a cache line by default, which is also
+	// the width of AVX-512 registers: arrays never share a cache line, and kernels can use
+	// aligned loads. Allocators can ask for another alignment with an ARRAY_ALIGNMENT member,
+	// see AlignedAllocator.
+#ifndef UTILS_ARRAY_ALIGNMENT
+#   define UTILS_ARRAY_ALIGNMENT 64
+#endif
+
+	template<typename Allocator>
+	inline constexpr size_t kArrayAlignment = [] {
+		if constexpr (requires { Allocator::ARRAY_ALIGNMENT; }) {
+			return size_t(Allocator::ARRAY_ALIGNMENT);
+		} else {
+			return size_t(UTILS_ARRAY_ALIGNMENT);
+		}
+	}();
+
+	class HeapAllocator {
+	public:
+		HeapAllocator() noexcept = default;
+
+		// our allocator concept
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+			return aligned_alloc(size, alignment);
+		}
+
+		void free(void* p) noexcept {
+			aligned_free(p);
+		}
+
+		void free(void* p, size_t) noexcept {
+			this->free(p);
+		}
+
+		~HeapAllocator() noexcept = default;
+
+		void swap(HeapAllocator&) noexcept { }
+	};
+
+	// A single buffer handed out linearly. Freeing does nothing, reset() releases everything at
+	// once, e.g. the temporary SoAs of a frame at the end of the frame.
+	class LinearArena {
+	public:
+		explicit LinearArena(size_t size) noexcept
+			: mBegin(static_cast<char*>(aligned_alloc(size, alignof(std::max_align_t)))),
+			  mCurrent(mBegin), mEnd(mBegin + size) {
+			assert(mBegin);
+		}
+
+		~LinearArena() noexcept {
+			aligned_free(mBegin);
+		}
+
+		// not copyable
+		LinearArena(LinearArena const& rhs) = delete;
+		LinearArena& operator=(LinearArena const& rhs) = delete;
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+			uintptr_t const p = (uintptr_t(mCurrent) + alignment - 1) & ~uintptr_t(alignment - 1);
+			if (UTILS_UNLIKELY(p + size > uintptr_t(mEnd))) {
+				throw std::bad_alloc();
+			}
+			mCurrent = reinterpret_cast<char*>(p + size);
+			return reinterpret_cast<void*>(p);
+		}
+
+		// everything allocated so far becomes invalid
+		void reset() noexcept {
+			mCurrent = mBegin;
+		}
+
+		size_t getAllocatedSize() const noexcept {
+			return size_t(mCurrent - mBegin);
+		}
+
+		size_t getSize() const noexcept {
+			return size_t(mEnd - mBegin);
+		}
+
+	private:
+		char* const mBegin;
+		char* mCurrent;
+		char* const mEnd;
+	};
+
+	class ArenaAllocator {
+	public:
+		ArenaAllocator() noexcept = default;
+
+		explicit ArenaAllocator(LinearArena& arena) noexcept : mArena(&arena) {
+		}
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+			assert(mArena);
+			return mArena->alloc(size, alignment);
+		}
+
+		// the memory is released by LinearArena::reset()
+		void free(void*, size_t) noexcept {
+		}
+
+		void swap(ArenaAllocator& rhs) noexcept {
+			std::swap(mArena, rhs.mArena);
+		}
+
+	private:
+		LinearArena* mArena = nullptr;
+	};
+
+	// Blocks of a fixed size, recycled through a free list: SoAs of the same capacity, like
+	// fixed-capacity managers or ChunkedStructureOfArrays blocks, reuse each other's memory
+	// instead of going to the heap. Asking for more than a block, or a stricter alignment, throws
+	// std::bad_alloc. Not thread safe.
+	class Pool {
+	public:
+		explicit Pool(size_t blockSize, size_t alignment = UTILS_ARRAY_ALIGNMENT) noexcept
+			: mBlockSize(std::max(blockSize, sizeof(Node))), mAlignment(alignment) {
+		}
+
+		~Pool() noexcept {
+			// all the blocks must have been given back
+			assert(mOutstanding == 0);
+			while (mHead) {
+				Node* const next = mHead->next;
+				aligned_free(mHead);
+				mHead = next;
+			}
+		}
+
+		// not copyable
+		Pool(Pool const& rhs) = delete;
+		Pool& operator=(Pool const& rhs) = delete;
+
+		// makes sure the next count allocations don't go to the heap
+		void reserve(size_t count) {
+			for (size_t i = mFreeCount; i < count; i++) {
+				push(allocBlock());
+			}
+		}
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+			if (UTILS_UNLIKELY(size > mBlockSize || alignment > mAlignment)) {
+				throw std::bad_alloc();
+			}
+			mOutstanding++;
+			if (mHead) {
+				Node* const node = mHead;
+				mHead = node->next;
+				mFreeCount--;
+				return node;
+			}
+			return allocBlock();
+		}
+
+		void free(void* p) noexcept {
+			if (p) {
+				assert(mOutstanding);
+				mOutstanding--;
+				push(p);
+			}
+		}
+
+		size_t getBlockSize() const noexcept {
+			return mBlockSize;
+		}
+
+	private:
+		struct Node {
+			Node* next;
+		};
+
+		void* allocBlock() {
+			void* const p = aligned_alloc(mBlockSize, mAlignment);
+			if (UTILS_UNLIKELY(!p)) {
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+
+		void push(void* p) noexcept {
+			mHead = new(p) Node{ mHead };
+			mFreeCount++;
+		}
+
+		size_t const mBlockSize;
+		size_t const mAlignment;
+		Node* mHead = nullptr;
+		size_t mFreeCount = 0;
+		size_t mOutstanding = 0;
+	};
+
+	class PoolAllocator {
+	public:
+		PoolAllocator() noexcept = default;
+
+		explicit PoolAllocator(Pool& pool) noexcept : mPool(&pool) {
+		}
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+			assert(mPool);
+			return mPool->alloc(size, alignment);
+		}
+
+		void free(void* p, size_t) noexcept {
+			if (p) {
+				mPool->free(p);
+			}
+		}
+
+		void swap(PoolAllocator& rhs) noexcept {
+			std::swap(mPool, rhs.mPool);
+		}
+
+	private:
+		Pool* mPool = nullptr;
+	};
+
+	// Maps large allocations directly, aligned on 2 MiB and with transparent huge pages
+	// requested, so that a column of several GB takes 512x fewer TLB entries. Smaller ones, and
+	// all of them on platforms without mmap, go to the heap.
+	class HugePageAllocator {
+	public:
+		static constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+		HugePageAllocator() noexcept = default;
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+#if UTILS_HAS_MMAP
+			if (size >= HUGE_PAGE_SIZE) {
+				assert(alignment <= HUGE_PAGE_SIZE);
+				size_t const mapped = roundUp(size);
+				// map an extra huge page, and trim it to get an aligned range
+				char* const p = static_cast<char*>(::mmap(nullptr, mapped + HUGE_PAGE_SIZE,
+						PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+				if (UTILS_UNLIKELY(p == MAP_FAILED)) {
+					return nullptr;
+				}
+				char* const aligned = reinterpret_cast<char*>(roundUp(size_t(p)));
+				if (aligned != p) {
+					::munmap(p, size_t(aligned - p));
+				}
+				size_t const tail = size_t(p + HUGE_PAGE_SIZE - aligned);
+				if (tail) {
+					::munmap(aligned + mapped, tail);
+				}
+#if defined(MADV_HUGEPAGE)
+				::madvise(aligned, mapped, MADV_HUGEPAGE);
+#endif
+				return aligned;
+			}
+#endif
+			return aligned_alloc(size, alignment);
+		}
+
+		void free(void* p, size_t size) noexcept {
+#if UTILS_HAS_MMAP
+			if (size >= HUGE_PAGE_SIZE) {
+				if (p) {
+					::munmap(p, roundUp(size));
+				}
+				return;
+			}
+#endif
+			aligned_free(p);
+		}
+
+		void swap(HugePageAllocator&) noexcept { }
+
+	private:
+		static constexpr size_t roundUp(size_t size) noexcept {
+			return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		}
+	};
+
+	// Allocator with arrays aligned on ALIGNMENT bytes rather than UTILS_ARRAY_ALIGNMENT, e.g.
+	// 32 for AVX2 kernels, or 128 where cache lines are that large.
+	template<size_t ALIGNMENT, typename Allocator = HeapAllocator>
+	class AlignedAllocator : public Allocator {
+		static_assert(ALIGNMENT >= sizeof(void*) && !(ALIGNMENT & (ALIGNMENT - 1)),
+			"ALIGNMENT must be a power of two, at least the size of a pointer");
+	public:
+		static constexpr size_t ARRAY_ALIGNMENT = ALIGNMENT;
+
+		using Allocator::Allocator;
+
+		void swap(AlignedAllocator& rhs) noexcept {
+			Allocator::swap(rhs);
+		}
+	};
+
+	// Maps each allocation, and moves whole pages between allocations with mremap() rather than
+	// copying them. StructureOfArrays then grows arrays of trivially copyable elements with a
+	// remap per array, whatever their size; since each array starts on a page, it's meant for
+	// large managers. Where mremap() isn't available, remap() fails and the arrays are copied.
+	class MappedAllocator {
+	public:
+		static constexpr size_t PAGE_SIZE = 4096;
+
+		MappedAllocator() noexcept = default;
+
+		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
+#if UTILS_HAS_MMAP
+			assert(alignment <= PAGE_SIZE);
+			(void)alignment;
+			void* const p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			return p == MAP_FAILED ? nullptr : p;
+#else
+			return aligned_alloc(size, alignment);
+#endif
+		}
+
+		void free(void* p, size_t size) noexcept {
+#if UTILS_HAS_MMAP
+			if (p) {
+				::munmap(p, size);
+			}
+#else
+			aligned_free(p);
+#endif
+		}
+
+		// Moves the pages of [src, src + size) to dst, replacing what was mapped there; src is
+		// unmapped afterwards. Returns false, and does nothing, if the pages can't be moved.
+		bool remap(void* dst, void* src, size_t size) noexcept {
+#if defined(__linux__) && defined(MREMAP_FIXED)
+			static size_t const pageSize = size_t(::sysconf(_SC_PAGESIZE));
+			if (size && ((uintptr_t(dst) | uintptr_t(src) | size) & (pageSize - 1)) == 0) {
+				return ::mremap(src, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, dst) != MAP_FAILED;
+			}
+#endif
+			(void)dst;
+			(void)src;
+			(void)size;
+			return false;
+		}
+
+		void swap(MappedAllocator&) noexcept { }
+	};
+
+} // namespace utils
+
+#endif // TNT_UTILS_ALLOCATOR_H
@@ -0,0 +1,350 @@
+#ifndef TNT_UTILS_CHUNKEDSTRUCTUREOFARRAYS_H
+#define TNT_UTILS_CHUNKEDSTRUCTUREOFARRAYS_H
+
+#include <utils/compiler.h>
+#include <utils/Slice.h>
+#include <utils/StructureOfArrays.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+/*
+ * A StructureOfArrays that stores its rows in blocks of BLOCK_SIZE rows, each block holding
+ * all the arrays. Growing allocates new blocks and never moves the existing rows, so the
+ * addresses of the elements are stable and growing costs no copy, whatever the size.
+ *
+ * The arrays are only contiguous within a block; tight loops should go a block at a time,
+ * with forEachBlock() or blockData().
+ */
+template <typename Allocator, size_t BLOCK_SIZE, typename ... Elements>
+class ChunkedStructureOfArraysBase {
+    static_assert(BLOCK_SIZE && !(BLOCK_SIZE & (BLOCK_SIZE - 1)), "BLOCK_SIZE must be a power of two");
+
+    // number of elements
+    static constexpr const size_t kArrayCount = sizeof...(Elements);
+    static constexpr const size_t kBlockShift = std::countr_zero(BLOCK_SIZE);
+    static constexpr const size_t kBlockMask = BLOCK_SIZE - 1;
+
+public:
+    using Structure = std::tuple<Elements...>;
+
+    // Type of the Nth array
+    template<size_t N>
+    using TypeAt = typename std::tuple_element_t<N, Structure>;
+
+    // Number of arrays
+    static constexpr size_t getArrayCount() noexcept { return kArrayCount; }
+
+    // Number of rows in a block
+    static constexpr size_t getBlockSize() noexcept { return BLOCK_SIZE; }
+
+    // Size of the allocation of a block
+    static constexpr size_t getBlockBytes() noexcept { return kBlockBytes; }
+
+    static constexpr size_t getBlockAlignment() noexcept { return kBlockAlignment; }
+
+    // --------------------------------------------------------------------------------------------
+
+    ChunkedStructureOfArraysBase() = default;
+
+    explicit ChunkedStructureOfArraysBase(size_t capacity) {
+        setCapacity(capacity);
+    }
+
+    // for allocators that are handles to an arena or a pool, e.g. a Pool of getBlockBytes()
+    explicit ChunkedStructureOfArraysBase(Allocator const& allocator) noexcept
+            : mAllocator(allocator) {
+    }
+
+    // not copyable for now
+    ChunkedStructureOfArraysBase(ChunkedStructureOfArraysBase const& rhs) = delete;
+    ChunkedStructureOfArraysBase& operator=(ChunkedStructureOfArraysBase const& rhs) = delete;
+
+    ChunkedStructureOfArraysBase(ChunkedStructureOfArraysBase&& rhs) noexcept {
+        using std::swap;
+        swap(mSize, rhs.mSize);
+        swap(mBlocks, rhs.mBlocks);
+        swap(mAllocator, rhs.mAllocator);
+    }
+
+    ChunkedStructureOfArraysBase& operator=(ChunkedStructureOfArraysBase&& rhs) noexcept {
+        if (this != &rhs) {
+            using std::swap;
+            swap(mSize, rhs.mSize);
+            swap(mBlocks, rhs.mBlocks);
+            swap(mAllocator, rhs.mAllocator);
+        }
+        return *this;
+    }
+
+    ~ChunkedStructureOfArraysBase() {
+        destroy_each(0, mSize);
+        for (char* block : mBlocks) {
+            mAllocator.free(block, kBlockBytes);
+        }
+    }
+
+    // --------------------------------------------------------------------------------------------
+
+    // return the size the array
+    size_t size() const noexcept {
+        return mSize;
+    }
+
+    // return the capacity of the array, always a multiple of the block size
+    size_t capacity() const noexcept {
+        return mBlocks.size() * BLOCK_SIZE;
+    }
+
+    // Set the capacity of the array, rounded up to a whole number of blocks. Growing allocates
+    // the missing blocks, shrinking frees the blocks past the size.
+    UTILS_NOINLINE
+    void setCapacity(size_t capacity) {
+        size_t const count = (std::max(capacity, mSize) + kBlockMask) >> kBlockShift;
+        while (mBlocks.size() < count) {
+            mBlocks.push_back(static_cast<char*>(mAllocator.alloc(kBlockBytes, kBlockAlignment)));
+        }
+        while (mBlocks.size() > count) {
+            mAllocator.free(mBlocks.back(), kBlockBytes);
+            mBlocks.pop_back();
+        }
+    }
+
+    void ensureCapacity(size_t needed) {
+        if (UTILS_UNLIKELY(needed > capacity())) {
+            // blocks never move, so there is no point in growing ahead
+            setCapacity(needed);
+        }
+    }
+
+    // free the blocks past the size, this doesn't move any element
+    void shrinkToFit() {
+        setCapacity(mSize);
+    }
+
+    // grow or shrink the array to the given size. When growing, new elements are constructed
+    // with their default constructor. when shrinking, discarded elements are destroyed.
+    UTILS_NOINLINE
+    void resize(size_t needed) {
+        ensureCapacity(needed);
+        if (needed < mSize) {
+            destroy_each(needed, mSize);
+        } else if (needed > mSize) {
+            construct_each(mSize, needed);
+        }
+        mSize = needed;
+    }
+
+    void clear() noexcept {
+        destroy_each(0, mSize);
+        mSize = 0;
+    }
+
+    void swap(size_t i, size_t j) noexcept {
+        swap(i, j, std::make_index_sequence<kArrayCount>());
+    }
+
+    // remove and destroy the last element of each array
+    void pop_back() noexcept {
+        if (mSize) {
+            destroy_each(mSize - 1, mSize);
+            mSize--;
+        }
+    }
+
+    // create an element at the end of each array
+    ChunkedStructureOfArraysBase& push_back() {
+        resize(mSize + 1);
+        return *this;
+    }
+
+    ChunkedStructureOfArraysBase& push_back(Elements const& ... args) {
+        ensureCapacity(mSize + 1);
+        emplace(mSize, std::make_index_sequence<kArrayCount>(), args...);
+        mSize++;
+        return *this;
+    }
+
+    ChunkedStructureOfArraysBase& push_back(Elements&& ... args) {
+        ensureCapacity(mSize + 1);
+        emplace(mSize, std::make_index_sequence<kArrayCount>(), std::forward<Elements>(args)...);
+        mSize++;
+        return *this;
+    }
+
+    // return a reference to the index'th element of the ElementIndex'th array
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex>& elementAt(size_t index) noexcept {
+        assert(index < capacity());
+        return blockData<ElementIndex>(index >> kBlockShift)[index & kBlockMask];
+    }
+
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex> const& elementAt(size_t index) const noexcept {
+        assert(index < capacity());
+        return blockData<ElementIndex>(index >> kBlockShift)[index & kBlockMask];
+    }
+
+    // return a reference to the last element of the ElementIndex'th array
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex>& back() noexcept {
+        return elementAt<ElementIndex>(mSize - 1);
+    }
+
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex> const& back() const noexcept {
+        return elementAt<ElementIndex>(mSize - 1);
+    }
+
+    // --------------------------------------------------------------------------------------------
+
+    // number of allocated blocks, including the ones past the size
+    size_t getBlockCount() const noexcept {
+        return mBlocks.size();
+    }
+
+    // number of elements in the given block
+    size_t getBlockElementCount(size_t block) const noexcept {
+        size_t const first = block << kBlockShift;
+        return first < mSize ? std::min(BLOCK_SIZE, mSize - first) : 0;
+    }
+
+    // return a pointer to the first element of the ElementIndex'th array of a block
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex>* blockData(size_t block) noexcept {
+        assert(block < mBlocks.size());
+        return reinterpret_cast<TypeAt<ElementIndex>*>(mBlocks[block] + kOffsets[ElementIndex]);
+    }
+
+    template<size_t ElementIndex>
+    TypeAt<ElementIndex> const* blockData(size_t block) const noexcept {
+        assert(block < mBlocks.size());
+        return reinterpret_cast<TypeAt<ElementIndex> const*>(mBlocks[block] + kOffsets[ElementIndex]);
+    }
+
+    template<size_t ElementIndex>
+    Slice<TypeAt<ElementIndex>> blockSlice(size_t block) noexcept {
+        TypeAt<ElementIndex>* const p = blockData<ElementIndex>(block);
+        return { p, p + getBlockElementCount(block) };
+    }
+
+    template<size_t ElementIndex>
+    Slice<const TypeAt<ElementIndex>> blockSlice(size_t block) const noexcept {
+        TypeAt<ElementIndex> const* const p = blockData<ElementIndex>(block);
+        return { p, p + getBlockElementCount(block) };
+    }
+
+    // Calls f(size_t first, Slice<TypeAt<ElementIndex>>...) for each non-empty block, first being
+    // the index of the block's first element.
+    template<size_t ... ElementIndex, typename F>
+    void forEachBlock(F&& f) {
+        for (size_t block = 0, first = 0; first < mSize; block++, first += BLOCK_SIZE) {
+            f(first, blockSlice<ElementIndex>(block) ...);
+        }
+    }
+
+private:
+    static constexpr std::array<size_t, kArrayCount> getOffsets() noexcept {
+        // every block has the same layout, so it's computed once
+        constexpr size_t sizes[] = { (sizeof(Elements) * BLOCK_SIZE)... };
+        constexpr size_t alignments[] = { std::max(kArrayAlignment<Allocator>, alignof(Elements))... };
+        std::array<size_t, kArrayCount> offsets{};
+        for (size_t i = 1; i < kArrayCount; i++) {
+            size_t const end = offsets[i - 1] + sizes[i - 1];
+            offsets[i] = (end + alignments[i] - 1) / alignments[i] * alignments[i];
+        }
+        return offsets;
+    }
+
+    static constexpr std::array<size_t, kArrayCount> kOffsets = getOffsets();
+    static constexpr size_t kBlockBytes = kOffsets[kArrayCount - 1] +
+            sizeof(TypeAt<kArrayCount - 1>) * BLOCK_SIZE;
+    static constexpr size_t kBlockAlignment =
+            std::max({ std::max(kArrayAlignment<Allocator>, alignof(Elements))... });
+
+    template<size_t ... Is, typename ... ARGS>
+    void emplace(size_t index, std::index_sequence<Is...>, ARGS&& ... args) {
+        (new(&elementAt<Is>(index)) Elements{ std::forward<ARGS>(args) }, ...);
+    }
+
+    template<size_t ... Is>
+    void swap(size_t i, size_t j, std::index_sequence<Is...>) noexcept {
+        using std::swap;
+        (swap(elementAt<Is>(i), elementAt<Is>(j)), ...);
+    }
+
+    template<typename F>
+    void forEachRange(size_t from, size_t to, F&& f) noexcept {
+        // calls f(block, first row in the block, count) for each block touched by [from, to)
+        while (from < to) {
+            size_t const block = from >> kBlockShift;
+            size_t const count = std::min(to, (block + 1) << kBlockShift) - from;
+            f(block, from & kBlockMask, count);
+            from += count;
+        }
+    }
+
+    void construct_each(size_t from, size_t to) noexcept {
+        forEachRange(from, to, [this](size_t block, size_t first, size_t count) {
+            construct_block(block, first, count, std::make_index_sequence<kArrayCount>());
+        });
+    }
+
+    void destroy_each(size_t from, size_t to) noexcept {
+        forEachRange(from, to, [this](size_t block, size_t first, size_t count) {
+            destroy_block(block, first, count, std::make_index_sequence<kArrayCount>());
+        });
+    }
+
+    template<size_t ... Is>
+    void construct_block(size_t block, size_t first, size_t count, std::index_sequence<Is...>) noexcept {
+        ([&] {
+            using T = TypeAt<Is>;
+            // note: scalar types like int/float get initialized to zero
+            if constexpr (!std::is_trivially_default_constructible_v<T>) {
+                T* const p = blockData<Is>(block) + first;
+                for (size_t i = 0; i < count; i++) {
+                    new(p + i) T();
+                }
+            }
+        }(), ...);
+    }
+
+    template<size_t ... Is>
+    void destroy_block(size_t block, size_t first, size_t count, std::index_sequence<Is...>) noexcept {
+        ([&] {
+            using T = TypeAt<Is>;
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                T* const p = blockData<Is>(block) + first;
+                for (size_t i = 0; i < count; i++) {
+                    p[i].~T();
+                }
+            }
+        }(), ...);
+    }
+
+    // size in array elements
+    size_t mSize = 0;
+    // one allocation per block, holding all the arrays
+    std::vector<char*> mBlocks;
+    Allocator mAllocator;
+};
+
+template <size_t BLOCK_SIZE, typename ... Elements>
+using ChunkedStructureOfArrays = ChunkedStructureOfArraysBase<HeapAllocator, BLOCK_SIZE, Elements ...>;
+
+} // namespace utils
+
+#endif // TNT_UTILS_CHUNKEDSTRUCTUREOFARRAYS_H
@@ -18,7 +18,7 @@
 #define TNT_UTILS_STRUCTUREOFARRAYS_H
 
 #include <type_traits>
-//#include <utils/Allocator.h>
+#include <utils/Allocator.h>
 #include <utils/compiler.h>
 //#include <utils/debug.h>
 #include <utils/Slice.h>
@@ -30,66 +30,41 @@
 
 #include <algorithm>
 #include <array>        // note: this is safe, see how std::array is used below (inline / private)
+#include <concepts>
 #include <cstddef>
 #include <iterator>     // for std::random_access_iterator_tag
+#include <numeric>
 #include <tuple>
 #include <utility>
 
 namespace utils {
 
 
-	inline void* aligned_alloc(size_t size, size_t align) noexcept {
-		// 'align' must be a power of two and a multiple of sizeof(void*)
-		align = (align < sizeof(void*)) ? sizeof(void*) : align;
-		assert(align && !(align & align - 1));
-		assert((align % sizeof(void*)) == 0);
-
-		void* p = nullptr;
-
-#if defined(WIN32)
-		p = ::_aligned_malloc(size, align);
-#else
-		::posix_memalign(&p, align, size);
-#endif
-		return p;
-	}
-
-	inline void aligned_free(void* p) noexcept {
-#if defined(WIN32)
-		::_aligned_free(p);
-#else
-		::free(p);
-#endif
-	}
-
-	class HeapAllocator {
-	public:
-		HeapAllocator() noexcept = default;
-
-		// our allocator concept
-		void* alloc(size_t size, size_t alignment = alignof(std::max_align_t)) {
-			return aligned_alloc(size, alignment);
-		}
-
-		void free(void* p) noexcept {
-			aligned_free(p);
-		}
-
-		void free(void* p, size_t) noexcept {
-			this->free(p);
-		}
-
-		~HeapAllocator() noexcept = default;
-
-		void swap(HeapAllocator&) noexcept { }
-	};
-
-
 template <typename Allocator, typename ... Elements>
 class StructureOfArraysBase {
     // number of elements
     static constexpr const size_t kArrayCount = sizeof...(Elements);
 
+    // When the allocator can move pages between its allocations (see MappedAllocator) and all
+    // the elements are trivially copyable, each array starts on a page, so that growing moves
+    // the pages of each array instead of copying them.
+    static constexpr const bool kRemapArrays = requires(Allocator& a, void* p) {
+        { a.remap(p, p, size_t(0)) } -> std::same_as<bool>;
+    } && (std::is_trivially_copyable_v<Elements> && ...);
+
+    static constexpr size_t getArrayAlignment() noexcept {
+        if constexpr (kRemapArrays) {
+            return std::max(Allocator::PAGE_SIZE, kArrayAlignment<Allocator>);
+        } else {
+            return kArrayAlignment<Allocator>;
+        }
+    }
+
+    // the capacity is a multiple of this, so that every array is a whole number of
+    // kArrayAlignment<Allocator> bytes
+    static constexpr size_t kCapacityGranularity = std::max({
+            kArrayAlignment<Allocator> / std::gcd(sizeof(Elements), kArrayAlignment<Allocator>)... });
+
 public:
     using SoA = StructureOfArraysBase<Allocator, Elements...>;
 
@@ -102,9 +77,15 @@ public:
     // Number of arrays
     static constexpr size_t getArrayCount() noexcept { return kArrayCount; }
 
+    // The capacity is always a multiple of this
+    static constexpr size_t getCapacityGranularity() noexcept { return kCapacityGranularity; }
+
     // Size needed to store "size" array elements
     static size_t getNeededSize(size_t size) noexcept {
-        return getOffset(kArrayCount - 1, size) + sizeof(TypeAt<kArrayCount - 1>) * size;
+        size = roundUp(size, kCapacityGranularity);
+        size_t const needed = getOffset(kArrayCount - 1, size) + sizeof(TypeAt<kArrayCount - 1>) * size;
+        // the last array moves whole pages too
+        return kRemapArrays ? roundUp(needed, getArrayAlignment()) : needed;
     }
 
     // --------------------------------------------------------------------------------------------
@@ -274,6 +255,16 @@ public:
         setCapacity(capacity);
     }
 
+    // for allocators that are handles to an arena or a pool
+    explicit StructureOfArraysBase(Allocator const& allocator) noexcept
+            : mAllocator(allocator) {
+    }
+
+    StructureOfArraysBase(size_t capacity, Allocator const& allocator)
+            : mAllocator(allocator) {
+        setCapacity(capacity);
+    }
+
     // not copyable for now
     StructureOfArraysBase(StructureOfArraysBase const& rhs) = delete;
     StructureOfArraysBase& operator=(StructureOfArraysBase const& rhs) = delete;
@@ -300,7 +291,7 @@ public:
 
     ~StructureOfArraysBase() {
         destroy_each(0, mSize);
-        mAllocator.free(std::get<0>(mArrays));
+        mAllocator.free(std::get<0>(mArrays), getNeededSize(mCapacity));
     }
 
     // --------------------------------------------------------------------------------------------
@@ -310,20 +301,28 @@ public:
         return mSize;
     }
 
+    // Return the size rounded up to the capacity granularity, which the capacity always holds.
+    // Kernels can process that many elements a SIMD vector at a time, with aligned loads and no
+    // scalar tail; the elements past the size aren't constructed, though.
+    size_t paddedSize() const noexcept {
+        return roundUp(mSize, kCapacityGranularity);
+    }
+
     // return the capacity of the array
     size_t capacity() const noexcept {
         return mCapacity;
     }
 
-    // set the capacity of the array. the capacity cannot be smaller than the current size,
-    // the call is a no-op in that case.
+    // set the capacity of the array, rounded up to the capacity granularity. the capacity
+    // cannot be smaller than the current size, the call is a no-op in that case.
     UTILS_NOINLINE
     void setCapacity(size_t capacity) {
+        capacity = roundUp(capacity, kCapacityGranularity);
         // allocate enough space for "capacity" elements of each array
         // capacity cannot change when optional storage is specified
         if (capacity >= mSize) {
             // TODO: not entirely sure if "max" of all alignments is always correct
-            constexpr size_t align = std::max({ std::max(alignof(std::max_align_t), alignof(Elements))... });
+            constexpr size_t align = std::max({ std::max(getArrayAlignment(), alignof(Elements))... });
             const size_t sizeNeeded = getNeededSize(capacity);
             void* buffer = mAllocator.alloc(sizeNeeded, align);
             auto const oldBuffer = std::get<0>(mArrays);
@@ -333,7 +332,7 @@ public:
             move_each(buffer, capacity);
 
             // free the old buffer
-            mAllocator.free(oldBuffer);
+            mAllocator.free(oldBuffer, getNeededSize(mCapacity));
 
             // and make sure to update the capacity
             mCapacity = capacity;
@@ -351,20 +350,103 @@ public:
     // grow or shrink the array to the given size. When growing, new elements are constructed
     // with their default constructor. when shrinking, discarded elements are destroyed.
     // If the arrays don't have enough capacity, the capacity is increased accordingly
-    // (the capacity is set to 3/2 of the asked size).
+    // (the capacity is set to 3/2 of the asked size). The capacity never decreases, see trim().
     UTILS_NOINLINE
     void resize(size_t needed) {
         ensureCapacity(needed);
         resizeNoCheck(needed);
-        if (needed <= mCapacity) {
-            // TODO: see if we should shrink the arrays
+    }
+
+    // reallocate the arrays to the smallest capacity that holds the size
+    void shrinkToFit() {
+        if (roundUp(mSize, kCapacityGranularity) < mCapacity) {
+            setCapacity(mSize);
         }
     }
 
+    // Once less than 1/SHRINK_RATIO of the capacity is used, reallocate the arrays to the
+    // capacity growing to the current size would give. Growing and trimming back and forth
+    // around a size then doesn't reallocate every time. Returns true if the arrays were
+    // reallocated.
+    static constexpr size_t SHRINK_RATIO = 4;
+
+    bool trim() {
+        size_t const capacity = getTrimmedCapacity(mSize);
+        if (capacity < mCapacity) {
+            setCapacity(capacity);
+            return true;
+        }
+        return false;
+    }
+
+    // the capacity trim() would give the arrays if they held size elements, or the current one
+    size_t getTrimmedCapacity(size_t size) const noexcept {
+        size_t const capacity = roundUp((size * 3 + 1) / 2, kCapacityGranularity);
+        return size < mCapacity / SHRINK_RATIO && capacity < mCapacity ? capacity : mCapacity;
+    }
+
     void clear() noexcept {
         resizeNoCheck(0);
     }
 
+    // like resize(), but trivial types are zeroed too, like push_back(Structure{}) would
+    void resizeZeroed(size_t needed) {
+        size_t const from = mSize;
+        resize(needed);
+        if (needed > from) {
+            forEach([from, needed](auto p) {
+                using T = std::decay_t<decltype(*p)>;
+                if constexpr (std::is_trivially_default_constructible_v<T>) {
+                    std::fill(p + from, p + needed, T{});
+                }
+            });
+        }
+    }
+
+    // Stores values[i] at index rows[i] of the ElementIndex'th array, for the rows[i] >= first,
+    // which must have been numbered in order from first. When all n values got such a row,
+    // this is a single memcpy.
+    template<size_t ElementIndex, typename Row>
+    void assignNewRows(size_t first, size_t n, TypeAt<ElementIndex> const* values, Row const* rows) noexcept {
+        static_assert(std::is_trivially_copyable_v<TypeAt<ElementIndex>>);
+        TypeAt<ElementIndex>* const array = data<ElementIndex>();
+        if (mSize - first == n) {
+            memcpy(array + first, values, n * sizeof(TypeAt<ElementIndex>));
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                if (rows[i] >= first) {
+                    array[rows[i]] = values[i];
+                }
+            }
+        }
+    }
+
+    // Removes the count elements at the given sorted, unique indices in a single pass: the
+    // lowest holes are filled with the last elements, and the removed ones at the end are
+    // dropped. moved(hole) is called after an element was moved into a hole.
+    template<typename Row, typename F>
+    void eraseSorted(Row const* holes, size_t count, F&& moved) noexcept {
+        if (!count) {
+            return;
+        }
+        size_t last = mSize - 1;
+        size_t first = 0;
+        while (first < count) {
+            if (holes[count - 1] == last) {
+                count--;
+                last--;
+                continue;
+            }
+            size_t const hole = holes[first++];
+            forEach([hole, last](auto* p) {
+                p[hole] = std::move(p[last]);
+            });
+            moved(hole);
+            last--;
+        }
+        resizeNoCheck(last + 1);
+    }
+
 
     inline void swap(size_t i, size_t j) noexcept {
         forEach([i, j](auto p) {
@@ -672,6 +754,10 @@ private:
         mSize = needed;
     }
 
+    static constexpr size_t roundUp(size_t size, size_t alignment) noexcept {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
     // this calculates the offset adjusted for all data alignment of a given array
     static inline size_t getOffset(size_t index, size_t capacity) noexcept {
         auto offsets = getOffsets(capacity);
@@ -683,7 +769,7 @@ private:
         const size_t sizes[] = { (sizeof(Elements) * capacity)... };
 
         // we align each array to at least the same alignment guaranteed by malloc
-        constexpr size_t const alignments[] = { std::max(alignof(std::max_align_t), alignof(Elements))... };
+        constexpr size_t const alignments[] = { std::max(getArrayAlignment(), alignof(Elements))... };
 
         // hopefully most of this gets unrolled and inlined
         std::array<size_t, kArrayCount> offsets;
@@ -726,7 +812,7 @@ private:
         size_t index = 0;
         if (mSize) {
             auto size = mSize; // placate a compiler warning
-            forEach([buffer, &index, &offsets, size](auto p) {
+            forEach([this, buffer, &index, &offsets, size](auto p) {
                 using T = typename std::decay<decltype(*p)>::type;
                 T* UTILS_RESTRICT b = static_cast<T*>(buffer);
 
@@ -735,8 +821,13 @@ private:
                 T* UTILS_RESTRICT const arrayPointer =
                         reinterpret_cast<T*>(uintptr_t(b) + offsets[index]);
 
-                // for trivial cases, just call memcpy()
-                if constexpr (std::is_trivially_copyable_v<T> &&
+                if constexpr (kRemapArrays) {
+                    // move the pages holding the elements, or copy them if the allocator can't
+                    size_t const bytes = roundUp(size * sizeof(T), getArrayAlignment());
+                    if (!mAllocator.remap(arrayPointer, p, bytes)) {
+                        memcpy(arrayPointer, p, size * sizeof(T));
+                    }
+                } else if constexpr (std::is_trivially_copyable_v<T> &&
                               std::is_trivially_destructible_v<T>) {
                     memcpy(arrayPointer, p, size * sizeof(T));
                 } else {